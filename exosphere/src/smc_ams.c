@@ -87,13 +87,39 @@ void ams_unmap_irampage(void) {
     lock_release(&g_ams_iram_page_mapped);
 }
 
+static uint32_t ams_iram_fill(uintptr_t iram_address, size_t size, uint32_t pattern) {
+    /* IRAM is physically contiguous, so unlike DRAM copies a fill may span many pages. */
+    const uintptr_t iram_end = iram_address + size;
+    while (iram_address < iram_end) {
+        const uintptr_t iram_page_offset = (iram_address & 0xFFFULL);
+        const size_t cur_size = (iram_end - iram_address) < (0x1000 - iram_page_offset) ? (iram_end - iram_address) : (0x1000 - iram_page_offset);
+        
+        ams_map_irampage(iram_address);
+        
+        volatile uint32_t *iram_ptr = (volatile uint32_t *)(AMS_IRAM_PAGE_SECURE_MONITOR_ADDR + iram_page_offset);
+        const size_t num_dwords = cur_size / sizeof(uint32_t);
+        for (size_t i = 0; i < num_dwords; i++) {
+            iram_ptr[i] = pattern;
+        }
+        
+        flush_dcache_range((void *)iram_ptr, (void *)(iram_ptr + num_dwords));
+        
+        ams_unmap_irampage();
+        
+        iram_address += cur_size;
+    }
+    
+    return 0;
+}
+
 uint32_t ams_iram_copy(smc_args_t *args) {
-    /* Implements a DRAM <-> IRAM copy of up to one page. */
+    /* Implements a DRAM <-> IRAM copy of up to one page, or a fill of an IRAM range. */
     /* This operation is necessary to implement reboot-to-payload. */
-    /* args->X[1] = DRAM address (translated by kernel), must be 4-byte aligned. */
+    /* args->X[1] = DRAM address (translated by kernel), must be 4-byte aligned. Unused for fills. */
     /* args->X[2] = IRAM address, must be 4-byte aligned. */
-    /* args->X[3] = size (must be <= 0x1000 and 4-byte aligned). */
-    /* args->X[4] = 0 for read, 1 for write. */
+    /* args->X[3] = size (must be 4-byte aligned, and <= 0x1000 unless filling). */
+    /* args->X[4] = 0 for read, 1 for write, 2 for fill. */
+    /* args->X[5] = 32-bit fill pattern, for fills. */
     
     const uintptr_t dram_address = (uintptr_t)args->X[1];
     const uintptr_t iram_address = (uintptr_t)args->X[2];
@@ -101,6 +127,17 @@ uint32_t ams_iram_copy(smc_args_t *args) {
     const uintptr_t iram_page_offset = (iram_address & 0xFFFULL);
     const size_t size = args->X[3];
     const uint32_t option = (uint32_t)args->X[4];
+    
+    /* Fills don't touch DRAM, and may cover any part of IRAM. */
+    if (option == 2) {
+        if (!ams_is_iram_addr_valid(iram_address) || size == 0 || size > 0x40000 || !ams_is_iram_addr_valid(iram_address + size - 1)) {
+            return 2;
+        }
+        if (size % sizeof(uint32_t) || iram_page_offset % sizeof(uint32_t)) {
+            return 2;
+        }
+        return ams_iram_fill(iram_address, size, (uint32_t)args->X[5]);
+    }
             
     /* Validate addresses. */
     if (!ams_is_user_addr_valid(dram_address) || !ams_is_iram_addr_valid(iram_address)) {
@@ -19,13 +19,25 @@
 #include <strings.h>
 #include "bpcmitm_reboot_manager.hpp"
 #include "../utils.hpp"
+#include "../sha256.h"
 
 /* TODO: Find a way to pre-populate this with the contents of fusee-primary. */
 static u8 g_reboot_payload[IRAM_PAYLOAD_MAX_SIZE] __attribute__ ((aligned (0x1000)));
 static u8 g_work_page[0x1000] __attribute__ ((aligned (0x1000)));
 static bool g_payload_loaded = false;
+/* Only pages up to the end of the payload need to be copied, as the rest of IRAM is cleared. */
+static size_t g_payload_size = 0;
+static u8 g_payload_hash[0x20];
 static BpcRebootType g_reboot_type = BpcRebootType::ToPayload;
 
+static void CalculatePayloadHash(u8 *out_hash) {
+    struct sha256_state sha_ctx;
+    sha256_init(&sha_ctx);
+    sha256_update(&sha_ctx, g_reboot_payload, g_payload_size);
+    sha256_finalize(&sha_ctx);
+    sha256_finish(&sha_ctx, out_hash);
+}
+
 void BpcRebootManager::Initialize() {
     /* Open payload file. */
     FsFile payload_file;
@@ -39,7 +51,13 @@ void BpcRebootManager::Initialize() {
     
     /* Read payload file. */
     size_t actual_size;
-    fsFileRead(&payload_file, 0, g_reboot_payload, IRAM_PAYLOAD_MAX_SIZE, &actual_size);
+    if (R_FAILED(fsFileRead(&payload_file, 0, g_reboot_payload, IRAM_PAYLOAD_MAX_SIZE, &actual_size)) || actual_size == 0) {
+        return;
+    }
+    
+    /* Remember what we loaded, so we can check it's intact when we reboot. */
+    g_payload_size = (actual_size + 0xFFF) & ~0xFFFul;
+    CalculatePayloadHash(g_payload_hash);
     
     g_payload_loaded = true;
     
@@ -59,28 +77,67 @@ void BpcRebootManager::Initialize() {
     }
 }
 
+static bool FillIram(uintptr_t iram_addr, u32 pattern, size_t size) {
+    SecmonArgs args = {0};
+    args.X[0] = 0xF0000201;             /* smcAmsIramCopy */
+    args.X[1] = (u64)g_work_page;       /* DRAM Address, unused but still translated by the kernel */
+    args.X[2] = iram_addr;              /* IRAM Address */
+    args.X[3] = size;                   /* Fill size */
+    args.X[4] = 2;                      /* 2 = Fill */
+    args.X[5] = pattern;                /* Fill pattern */
+    svcCallSecureMonitor(&args);
+    
+    return args.X[0] == 0;
+}
+
 static void ClearIram() {
+    /* Overwrite all of IRAM with FFs, in a single call if the secure monitor supports fills. */
+    if (FillIram(IRAM_PAYLOAD_BASE, 0xFFFFFFFF, IRAM_PAYLOAD_MAX_SIZE)) {
+        return;
+    }
+    
     /* Make page FFs. */
     memset(g_work_page, 0xFF, sizeof(g_work_page));
     
-    /* Overwrite all of IRAM with FFs. */
+    /* Otherwise, copy FFs a page at a time. */
     for (size_t ofs = 0; ofs < IRAM_PAYLOAD_MAX_SIZE; ofs += sizeof(g_work_page)) {
         CopyToIram(IRAM_PAYLOAD_BASE + ofs, g_work_page, sizeof(g_work_page));
     }
 }
 
+static bool IsPageCleared(const u8 *page) {
+    const u64 *page_u64 = reinterpret_cast<const u64 *>(page);
+    for (size_t i = 0; i < 0x1000 / sizeof(u64); i++) {
+        if (page_u64[i] != 0xFFFFFFFFFFFFFFFFul) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static void DoRebootToPayload() {
     /* If we don't actually have a payload loaded, just go to RCM. */
     if (!g_payload_loaded) {
         RebootToRcm();
     }
     
+    /* Likewise if our copy of the payload has been corrupted since we loaded it. */
+    {
+        u8 hash[sizeof(g_payload_hash)];
+        CalculatePayloadHash(hash);
+        if (std::memcmp(hash, g_payload_hash, sizeof(hash)) != 0) {
+            RebootToRcm();
+        }
+    }
+    
     /* Ensure clean IRAM state. */
     ClearIram();
     
-    /* Copy in payload. */
-    for (size_t ofs = 0; ofs < sizeof(g_reboot_payload); ofs += 0x1000) {
-        CopyToIram(IRAM_PAYLOAD_BASE + ofs, &g_reboot_payload[ofs], 0x1000);
+    /* Copy in payload, skipping pages that are already all FFs. */
+    for (size_t ofs = 0; ofs < g_payload_size; ofs += 0x1000) {
+        if (!IsPageCleared(&g_reboot_payload[ofs])) {
+            CopyToIram(IRAM_PAYLOAD_BASE + ofs, &g_reboot_payload[ofs], 0x1000);
+        }
     }
     
     RebootToIramPayload();
@@ -16,25 +16,45 @@
  
 #include <switch.h>
 #include <cstring>
+#include <mutex>
+#include <algorithm>
 #include <stratosphere.hpp>
 
 #include "fsmitm_boot0storage.hpp"
 
+/* BOOT0 is locked by region, so that accesses past the BCTs (e.g. to the keyblobs) don't wait on BCT updates. */
+static HosMutex g_boot0_bct_mutex;
 static HosMutex g_boot0_mutex;
 static u8 g_boot0_bct_buffer[Boot0Storage::BctEndOffset];
 
+/* Locks the regions an access touches, always in the same order. */
+class Boot0RegionLock {
+    private:
+        std::unique_lock<HosMutex> bct_lk;
+        std::unique_lock<HosMutex> data_lk;
+    public:
+        Boot0RegionLock(size_t size, u64 offset) : bct_lk(g_boot0_bct_mutex, std::defer_lock), data_lk(g_boot0_mutex, std::defer_lock) {
+            if (offset < Boot0Storage::BctEndOffset) {
+                this->bct_lk.lock();
+            }
+            if (offset + size > Boot0Storage::BctEndOffset) {
+                this->data_lk.lock();
+            }
+        }
+};
+
 bool Boot0Storage::CanModifyBctPubks() {
     return this->title_id != 0x010000000000001FULL;
 }
 
 Result Boot0Storage::Read(void *_buffer, size_t size, u64 offset) {
-    std::scoped_lock<HosMutex> lk{g_boot0_mutex};
+    Boot0RegionLock lk(size, offset);
             
     return Base::Read(_buffer, size, offset);
 }
 
 Result Boot0Storage::Write(void *_buffer, size_t size, u64 offset) {
-    std::scoped_lock<HosMutex> lk{g_boot0_mutex};
+    Boot0RegionLock lk(size, offset);
     
     Result rc = 0;
     u8 *buffer = static_cast<u8 *>(_buffer);
@@ -85,24 +105,36 @@ Result Boot0Storage::Write(void *_buffer, size_t size, u64 offset) {
     /* First, let's deal with the data past the end. */
     if (offset + size >= BctEndOffset) {
         const u64 diff = BctEndOffset - offset;
-        if (R_FAILED((rc = ProxyStorage::Write(buffer + diff, size - diff, BctEndOffset)))) {
+        if (R_FAILED((rc = Base::Write(buffer + diff, size - diff, BctEndOffset)))) {
             return rc;
         }
         size = diff;
     }
     
-    /* Read in the current BCT region. */
-    if (R_FAILED((rc = ProxyStorage::Read(g_boot0_bct_buffer, BctEndOffset, 0)))) {
+    /* Read in only the sectors we're modifying. */
+    const u64 start = AlignDown(offset);
+    const u64 end = std::min(AlignUp(offset + size), BctEndOffset);
+    if (R_FAILED((rc = ProxyStorage::Read(g_boot0_bct_buffer, end - start, start)))) {
         return rc;
     }
     
-    /* Update the bct buffer. */
-    for (u64 cur_ofs = offset; cur_ofs < BctEndOffset && cur_ofs < offset + size; cur_ofs++) {
-        const u64 cur_bct_rel_ofs = cur_ofs % BctSize;
-        if (cur_bct_rel_ofs < BctPubkStart || BctPubkEnd <= cur_bct_rel_ofs) {
-            g_boot0_bct_buffer[cur_ofs] = buffer[cur_ofs - offset];
+    /* Update them, skipping the pubk of every BCT copy. */
+    const u64 write_end = offset + size;
+    u64 cur_ofs = offset;
+    while (cur_ofs < write_end) {
+        const u64 cur_bct_start = cur_ofs - (cur_ofs % BctSize);
+        if (cur_ofs < cur_bct_start + BctPubkStart) {
+            const u64 next_ofs = std::min(write_end, cur_bct_start + BctPubkStart);
+            memcpy(g_boot0_bct_buffer + (cur_ofs - start), buffer + (cur_ofs - offset), next_ofs - cur_ofs);
+            cur_ofs = next_ofs;
+        } else if (cur_ofs < cur_bct_start + BctPubkEnd) {
+            cur_ofs = std::min(write_end, cur_bct_start + BctPubkEnd);
+        } else {
+            const u64 next_ofs = std::min(write_end, cur_bct_start + BctSize);
+            memcpy(g_boot0_bct_buffer + (cur_ofs - start), buffer + (cur_ofs - offset), next_ofs - cur_ofs);
+            cur_ofs = next_ofs;
         }
     }
             
-    return ProxyStorage::Write(g_boot0_bct_buffer, BctEndOffset, 0);
+    return ProxyStorage::Write(g_boot0_bct_buffer, end - start, start);
 }
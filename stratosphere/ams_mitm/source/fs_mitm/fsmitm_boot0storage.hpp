@@ -22,17 +22,21 @@
 #include "fs_istorage.hpp"
 
 /* Represents a sectored storage. */
-template<u64 SectorSize> 
+/* Unaligned accesses read-modify-write their partial head and tail sectors, and pass the aligned middle straight through. */
+/* Accesses touching at most ScratchSectors sectors are instead handled with a single backend read (and write). */
+template<u64 SectorSize, u64 ScratchSectors = 2>
 class SectoredProxyStorage : public ProxyStorage {
+    static_assert(ScratchSectors >= 1, "SectoredProxyStorage needs at least one scratch sector!");
     private:
-        u64 cur_seek = 0;
-        u64 cur_sector = 0;
-        u64 cur_sector_ofs = 0;
-        u8  sector_buf[SectorSize];
-    private:
-        void Seek(u64 offset) {
-            this->cur_sector_ofs = offset % SectorSize;
-            this->cur_seek = offset - this->cur_sector_ofs;
+        /* Guards the scratch buffer, aligned accesses don't need it. */
+        HosMutex sector_buf_lock;
+        u8  sector_buf[SectorSize * ScratchSectors];
+    protected:
+        static constexpr u64 AlignDown(u64 offset) {
+            return offset - (offset % SectorSize);
+        }
+        static constexpr u64 AlignUp(u64 offset) {
+            return AlignDown(offset + SectorSize - 1);
         }
     public:
         SectoredProxyStorage(FsStorage *s) : ProxyStorage(s) { }
@@ -41,42 +45,49 @@ class SectoredProxyStorage : public ProxyStorage {
         virtual Result Read(void *_buffer, size_t size, u64 offset) override {
             Result rc = 0;
             u8 *buffer = static_cast<u8 *>(_buffer);
-            this->Seek(offset);
             
-            if (this->cur_sector_ofs == 0 && size % SectorSize == 0) {
+            if (offset % SectorSize == 0 && size % SectorSize == 0) {
                 /* Fast case. */
                 return ProxyStorage::Read(buffer, size, offset);
             }
             
-            if (R_FAILED((rc = ProxyStorage::Read(this->sector_buf, SectorSize, this->cur_seek)))) {
+            std::scoped_lock<HosMutex> lk{this->sector_buf_lock};
+            const u64 start = AlignDown(offset);
+            const u64 end = AlignUp(offset + size);
+            if (end - start <= sizeof(this->sector_buf)) {
+                /* Small case, everything fits in our scratch buffer. */
+                if (R_FAILED((rc = ProxyStorage::Read(this->sector_buf, end - start, start)))) {
+                    return rc;
+                }
+                memcpy(buffer, this->sector_buf + (offset - start), size);
                 return rc;
             }
             
-            if (size + this->cur_sector_ofs <= SectorSize) {
-                memcpy(buffer, sector_buf + this->cur_sector_ofs, size);
-            } else {
-                /* Leaving the sector... */
-                size_t ofs = SectorSize - this->cur_sector_ofs;
-                memcpy(buffer, sector_buf + this->cur_sector_ofs, ofs);
-                size -= ofs;
-                
-                /* We're guaranteed alignment, here. */
-                const size_t aligned_remaining_size = size - (size % SectorSize);
-                if (aligned_remaining_size) {
-                    if (R_FAILED((rc = ProxyStorage::Read(buffer + ofs, aligned_remaining_size, offset + ofs)))) {
-                        return rc;
-                    }
-                    ofs += aligned_remaining_size;
-                    size -= aligned_remaining_size;
+            /* Read the partial head sector. */
+            size_t ofs = 0;
+            if (offset != start) {
+                if (R_FAILED((rc = ProxyStorage::Read(this->sector_buf, SectorSize, start)))) {
+                    return rc;
                 }
-                
-                /* Read any leftover data. */
-                if (size) {
-                    if (R_FAILED((rc = ProxyStorage::Read(this->sector_buf, SectorSize, offset + ofs)))) {
-                        return rc;
-                    }
-                    memcpy(buffer + ofs, sector_buf, size);
+                ofs = start + SectorSize - offset;
+                memcpy(buffer, this->sector_buf + (offset - start), ofs);
+            }
+            
+            /* Read the aligned middle directly. */
+            const size_t aligned_size = AlignDown(offset + size) - (offset + ofs);
+            if (aligned_size) {
+                if (R_FAILED((rc = ProxyStorage::Read(buffer + ofs, aligned_size, offset + ofs)))) {
+                    return rc;
+                }
+                ofs += aligned_size;
+            }
+            
+            /* Read the partial tail sector. */
+            if (ofs < size) {
+                if (R_FAILED((rc = ProxyStorage::Read(this->sector_buf, SectorSize, offset + ofs)))) {
+                    return rc;
                 }
+                memcpy(buffer + ofs, this->sector_buf, size - ofs);
             }
             
             return rc;
@@ -84,49 +95,54 @@ class SectoredProxyStorage : public ProxyStorage {
         virtual Result Write(void *_buffer, size_t size, u64 offset) override {
             Result rc = 0;
             u8 *buffer = static_cast<u8 *>(_buffer);
-            this->Seek(offset);
             
-            if (this->cur_sector_ofs == 0 && size % SectorSize == 0) {
+            if (offset % SectorSize == 0 && size % SectorSize == 0) {
                 /* Fast case. */
                 return ProxyStorage::Write(buffer, size, offset);
             }
             
-            if (R_FAILED((rc = ProxyStorage::Read(this->sector_buf, SectorSize, this->cur_seek)))) {
-                return rc;
+            std::scoped_lock<HosMutex> lk{this->sector_buf_lock};
+            const u64 start = AlignDown(offset);
+            const u64 end = AlignUp(offset + size);
+            if (end - start <= sizeof(this->sector_buf)) {
+                /* Small case, everything fits in our scratch buffer. */
+                if (R_FAILED((rc = ProxyStorage::Read(this->sector_buf, end - start, start)))) {
+                    return rc;
+                }
+                memcpy(this->sector_buf + (offset - start), buffer, size);
+                return ProxyStorage::Write(this->sector_buf, end - start, start);
             }
             
-            
-            if (size + this->cur_sector_ofs <= SectorSize) {
-                memcpy(this->sector_buf + this->cur_sector_ofs, buffer, size);
-                rc = ProxyStorage::Write(this->sector_buf, SectorSize, this->cur_seek);
-            } else {
-                /* Leaving the sector... */
-                size_t ofs = SectorSize - this->cur_sector_ofs;
-                memcpy(this->sector_buf + this->cur_sector_ofs, buffer, ofs);
-                if (R_FAILED((rc = ProxyStorage::Write(this->sector_buf, ofs, this->cur_seek)))) {
+            /* Update the partial head sector. */
+            size_t ofs = 0;
+            if (offset != start) {
+                if (R_FAILED((rc = ProxyStorage::Read(this->sector_buf, SectorSize, start)))) {
                     return rc;
                 }
-                size -= ofs;
-                
-                /* We're guaranteed alignment, here. */
-                const size_t aligned_remaining_size = size - (size % SectorSize);
-                if (aligned_remaining_size) {
-                    if (R_FAILED((rc = ProxyStorage::Write(buffer + ofs, aligned_remaining_size, offset + ofs)))) {
-                        return rc;
-                    }
-                    ofs += aligned_remaining_size;
-                    size -= aligned_remaining_size;
+                ofs = start + SectorSize - offset;
+                memcpy(this->sector_buf + (offset - start), buffer, ofs);
+                if (R_FAILED((rc = ProxyStorage::Write(this->sector_buf, SectorSize, start)))) {
+                    return rc;
+                }
+            }
+            
+            /* Write the aligned middle directly. */
+            const size_t aligned_size = AlignDown(offset + size) - (offset + ofs);
+            if (aligned_size) {
+                if (R_FAILED((rc = ProxyStorage::Write(buffer + ofs, aligned_size, offset + ofs)))) {
+                    return rc;
                 }
-                
-                /* Write any leftover data. */
-                if (size) {
-                    if (R_FAILED((rc = ProxyStorage::Read(this->sector_buf, SectorSize, offset + ofs)))) {
-                        return rc;
-                    }
-                    memcpy(this->sector_buf, buffer + ofs, size);
-                    rc = ProxyStorage::Write(this->sector_buf, SectorSize, this->cur_seek);
+                ofs += aligned_size;
+            }
+            
+            /* Update the partial tail sector. */
+            if (ofs < size) {
+                if (R_FAILED((rc = ProxyStorage::Read(this->sector_buf, SectorSize, offset + ofs)))) {
+                    return rc;
                 }
-            }     
+                memcpy(this->sector_buf, buffer + ofs, size - ofs);
+                rc = ProxyStorage::Write(this->sector_buf, SectorSize, offset + ofs);
+            }
             
             return rc;
         };
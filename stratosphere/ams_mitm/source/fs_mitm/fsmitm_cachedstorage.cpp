@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2018 Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <switch.h>
+#include <cstring>
+#include <algorithm>
+#include <stratosphere.hpp>
+
+#include "fsmitm_cachedstorage.hpp"
+
+#include "../debug.hpp"
+
+bool CachedStorage::EnsureInitialized() {
+    if (!this->has_storage_size) {
+        if (R_FAILED(this->base_storage->GetSize(&this->storage_size))) {
+            return false;
+        }
+        this->has_storage_size = true;
+    }
+    if (this->block_data == nullptr) {
+        this->block_data = std::make_unique<u8[]>(this->block_size * this->block_count);
+        this->scratch_data = std::make_unique<u8[]>(this->block_size * this->max_coalesce_blocks);
+        this->blocks.resize(this->block_count);
+        this->InvalidateAll();
+    }
+    return true;
+}
+
+CachedStorage::Block *CachedStorage::FindBlock(u64 index) {
+    for (auto &block : this->blocks) {
+        if (block.is_valid && block.index == index) {
+            return &block;
+        }
+    }
+    return nullptr;
+}
+
+CachedStorage::Block *CachedStorage::AllocateBlock(u64 index) {
+    Block *victim = nullptr;
+    for (auto &block : this->blocks) {
+        if (!block.is_valid) {
+            victim = &block;
+            break;
+        }
+        if (victim == nullptr || block.last_used < victim->last_used) {
+            victim = &block;
+        }
+    }
+    victim->index = index;
+    victim->is_valid = true;
+    victim->valid_size = 0;
+    victim->last_used = ++this->use_counter;
+    return victim;
+}
+
+void CachedStorage::InvalidateRange(u64 offset, u64 size) {
+    for (auto &block : this->blocks) {
+        const u64 block_start = block.index * this->block_size;
+        if (block.is_valid && block_start < offset + size && offset < block_start + this->block_size) {
+            block.is_valid = false;
+        }
+    }
+}
+
+void CachedStorage::InvalidateAll() {
+    for (auto &block : this->blocks) {
+        block.is_valid = false;
+    }
+    this->sequential_count = 0;
+}
+
+Result CachedStorage::Read(void *_buffer, size_t size, u64 offset) {
+    Result rc;
+    u8 *buffer = static_cast<u8 *>(_buffer);
+
+    /* Large reads gain nothing from the cache, and would only evict useful blocks. */
+    if (size == 0 || size >= this->max_coalesce_blocks * this->block_size) {
+        return this->base_storage->Read(buffer, size, offset);
+    }
+
+    std::scoped_lock<HosMutex> lk(this->lock);
+    if (!this->EnsureInitialized() || offset >= this->storage_size || size > this->storage_size - offset) {
+        return this->base_storage->Read(buffer, size, offset);
+    }
+    this->stats.bytes_requested += size;
+
+    /* Track sequential access, growing read-ahead the longer it continues. */
+    if (offset == this->last_read_end) {
+        this->sequential_count = std::min(this->sequential_count + 1, this->max_coalesce_blocks);
+    } else {
+        this->sequential_count = 0;
+    }
+    this->last_read_end = offset + size;
+
+    const u64 end = offset + size;
+    const u64 end_index = (end - 1) / this->block_size;
+    const u64 total_blocks = (this->storage_size + this->block_size - 1) / this->block_size;
+    for (u64 cur_index = offset / this->block_size; cur_index <= end_index; cur_index++) {
+        Block *block = this->FindBlock(cur_index);
+        if (block == nullptr) {
+            /* Coalesce adjacent misses into a single read. */
+            u64 run_end = cur_index + 1;
+            while (run_end <= end_index && run_end - cur_index < this->max_coalesce_blocks && this->FindBlock(run_end) == nullptr) {
+                run_end++;
+            }
+            /* If access is sequential, read ahead past the end of the request. */
+            if (run_end > end_index) {
+                size_t read_ahead = this->sequential_count;
+                while (read_ahead > 0 && run_end < total_blocks && run_end - cur_index < this->max_coalesce_blocks && this->FindBlock(run_end) == nullptr) {
+                    run_end++;
+                    read_ahead--;
+                }
+            }
+
+            const u64 read_offset = cur_index * this->block_size;
+            const size_t read_size = std::min(run_end * this->block_size, this->storage_size) - read_offset;
+            if (R_FAILED((rc = this->base_storage->Read(this->scratch_data.get(), read_size, read_offset)))) {
+                return rc;
+            }
+            this->stats.misses += run_end - cur_index;
+            this->stats.backend_reads++;
+            this->stats.backend_bytes += read_size;
+
+            /* The run never exceeds half the cache, so none of these blocks evict each other. */
+            for (u64 i = cur_index; i < run_end; i++) {
+                Block *new_block = this->AllocateBlock(i);
+                new_block->valid_size = std::min(static_cast<u64>(this->block_size), this->storage_size - i * this->block_size);
+                std::memcpy(this->GetBlockData(new_block), this->scratch_data.get() + (i - cur_index) * this->block_size, new_block->valid_size);
+            }
+            block = this->FindBlock(cur_index);
+        } else {
+            this->stats.hits++;
+            block->last_used = ++this->use_counter;
+        }
+
+        const u64 block_start = cur_index * this->block_size;
+        const u64 copy_start = std::max(offset, block_start);
+        const u64 copy_end = std::min(end, block_start + block->valid_size);
+        std::memcpy(buffer + (copy_start - offset), this->GetBlockData(block) + (copy_start - block_start), copy_end - copy_start);
+    }
+
+    return 0;
+}
+
+Result CachedStorage::Write(void *buffer, size_t size, u64 offset) {
+    std::scoped_lock<HosMutex> lk(this->lock);
+    Result rc = this->base_storage->Write(buffer, size, offset);
+    /* Invalidate even on failure, as the write may have partially succeeded. */
+    this->InvalidateRange(offset, size);
+    return rc;
+}
+
+Result CachedStorage::Flush() {
+    return this->base_storage->Flush();
+}
+
+Result CachedStorage::SetSize(u64 size) {
+    std::scoped_lock<HosMutex> lk(this->lock);
+    Result rc = this->base_storage->SetSize(size);
+    this->InvalidateAll();
+    this->has_storage_size = false;
+    return rc;
+}
+
+Result CachedStorage::GetSize(u64 *out_size) {
+    return this->base_storage->GetSize(out_size);
+}
+
+Result CachedStorage::OperateRange(u32 operation_type, u64 offset, u64 size, FsRangeInfo *out_range_info) {
+    /* Operation type 2 invalidates caches, so drop ours too. */
+    if (operation_type == 2) {
+        std::scoped_lock<HosMutex> lk(this->lock);
+        this->InvalidateAll();
+    }
+    return this->base_storage->OperateRange(operation_type, offset, size, out_range_info);
+}
+
+void CachedStorage::GetStats(CachedStorageStats *out) {
+    std::scoped_lock<HosMutex> lk(this->lock);
+    *out = this->stats;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2018 Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <switch.h>
+#include <stratosphere.hpp>
+
+#include "fs_istorage.hpp"
+
+struct CachedStorageStats {
+    u64 hits;
+    u64 misses;
+    u64 bytes_requested;
+    u64 backend_reads;
+    u64 backend_bytes;
+};
+
+/* Caches small reads from some other storage in fixed-size blocks, with read-ahead for sequential access. */
+class CachedStorage : public IStorage {
+    public:
+        static constexpr size_t DefaultBlockSize = 0x4000;
+        static constexpr size_t DefaultBlockCount = 8;
+    private:
+        struct Block {
+            u64 index;
+            u64 last_used;
+            size_t valid_size;
+            bool is_valid;
+        };
+    private:
+        IStorage *base_storage;
+        HosMutex lock;
+        size_t block_size;
+        size_t block_count;
+        /* At most this many blocks are read from the base storage at once. */
+        size_t max_coalesce_blocks;
+        std::unique_ptr<u8[]> block_data;
+        std::unique_ptr<u8[]> scratch_data;
+        std::vector<Block> blocks;
+        u64 storage_size = 0;
+        bool has_storage_size = false;
+        u64 use_counter = 0;
+        u64 last_read_end = 0;
+        size_t sequential_count = 0;
+        CachedStorageStats stats = {};
+    private:
+        Block *FindBlock(u64 index);
+        Block *AllocateBlock(u64 index);
+        u8 *GetBlockData(Block *block) {
+            return this->block_data.get() + (block - this->blocks.data()) * this->block_size;
+        }
+        void InvalidateRange(u64 offset, u64 size);
+        void InvalidateAll();
+        bool EnsureInitialized();
+    public:
+        CachedStorage(IStorage *s, size_t bs = DefaultBlockSize, size_t bc = DefaultBlockCount) : base_storage(s), block_size(bs), block_count(bc) {
+            this->max_coalesce_blocks = bc / 2 ? bc / 2 : 1;
+        }
+        virtual ~CachedStorage() {
+            delete base_storage;
+        }
+
+        void GetStats(CachedStorageStats *out);
+    public:
+        virtual Result Read(void *buffer, size_t size, u64 offset) override;
+        virtual Result Write(void *buffer, size_t size, u64 offset) override;
+        virtual Result Flush() override;
+        virtual Result SetSize(u64 size) override;
+        virtual Result GetSize(u64 *out_size) override;
+        virtual Result OperateRange(u32 operation_type, u64 offset, u64 size, FsRangeInfo *out_range_info) override;
+};
@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2018 Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <switch.h>
+#include <stratosphere.hpp>
+
+#include "fsmitm_filecache.hpp"
+#include "../utils.hpp"
+
+#include "../debug.hpp"
+
+RomFSFileCache::~RomFSFileCache() {
+    for (size_t i = 0; i < MaxEntries; i++) {
+        if (this->entries[i].source != nullptr) {
+            fsFileClose(&this->entries[i].file);
+            this->entries[i].source = nullptr;
+        }
+    }
+}
+
+Result RomFSFileCache::OpenFile(const RomFSSourceInfo *source, FsFile *out) {
+    switch (source->type) {
+        case RomFSDataSource::MetaData:
+            return Utils::OpenSdFileForAtmosphere(this->title_id, ROMFS_METADATA_FILE_PATH, FS_OPEN_READ, out);
+        case RomFSDataSource::LooseFile:
+            return Utils::OpenRomFSSdFile(this->title_id, source->loose_source_info.path, FS_OPEN_READ, out);
+        default:
+            fatalSimple(0xF601);
+    }
+}
+
+RomFSFileCache::Entry *RomFSFileCache::FindEntry(const RomFSSourceInfo *source) {
+    for (size_t i = 0; i < MaxEntries; i++) {
+        if (this->entries[i].source == source) {
+            return &this->entries[i];
+        }
+    }
+    return nullptr;
+}
+
+RomFSFileCache::Entry *RomFSFileCache::FindFreeEntry() {
+    /* Prefer empty slots, otherwise evict the least recently used file nobody is reading from. */
+    Entry *lru = nullptr;
+    for (size_t i = 0; i < MaxEntries; i++) {
+        Entry *cur = &this->entries[i];
+        if (cur->source == nullptr) {
+            return cur;
+        }
+        if (cur->ref_count == 0 && (lru == nullptr || cur->last_used < lru->last_used)) {
+            lru = cur;
+        }
+    }
+    return lru;
+}
+
+Result RomFSFileCache::Acquire(const RomFSSourceInfo *source, FsFile *out_file, Entry **out_entry) {
+    /* Look for an open handle. */
+    {
+        std::scoped_lock<HosMutex> lk(this->lock);
+        Entry *entry = this->FindEntry(source);
+        if (entry != nullptr) {
+            entry->ref_count++;
+            entry->last_used = ++this->use_counter;
+            *out_file = entry->file;
+            *out_entry = entry;
+            this->num_hits++;
+            return 0;
+        }
+        this->num_misses++;
+    }
+    
+    /* Open the file ourselves, if we missed. */
+    *out_entry = nullptr;
+    return this->OpenFile(source, out_file);
+}
+
+void RomFSFileCache::Release(const RomFSSourceInfo *source, FsFile file, Entry *entry) {
+    /* Release our reference, or try to hand our handle to the cache. */
+    bool should_close = false;
+    FsFile to_close;
+    {
+        std::scoped_lock<HosMutex> lk(this->lock);
+        if (entry != nullptr) {
+            entry->ref_count--;
+        } else if (this->FindEntry(source) != nullptr) {
+            /* Someone else cached this file while we were using it. */
+            should_close = true;
+            to_close = file;
+        } else {
+            Entry *slot = this->FindFreeEntry();
+            if (slot == nullptr) {
+                /* Every cached file is in use, so don't cache this one. */
+                should_close = true;
+                to_close = file;
+            } else {
+                if (slot->source != nullptr) {
+                    should_close = true;
+                    to_close = slot->file;
+                    this->num_evictions++;
+                }
+                slot->source = source;
+                slot->file = file;
+                slot->last_used = ++this->use_counter;
+                slot->ref_count = 0;
+            }
+        }
+    }
+    if (should_close) {
+        fsFileClose(&to_close);
+    }
+}
+
+Result RomFSFileCache::Read(const RomFSSourceInfo *source, u64 offset, void *buffer, size_t size, size_t *out_read) {
+    Result rc;
+    FsFile file;
+    Entry *entry;
+    
+    if (R_FAILED((rc = this->Acquire(source, &file, &entry)))) {
+        return rc;
+    }
+    rc = fsFileRead(&file, offset, buffer, size, out_read);
+    this->Release(source, file, entry);
+    
+    return rc;
+}
+
+Result RomFSFileCache::OperateRange(const RomFSSourceInfo *source, u32 operation_type, u64 offset, u64 size, FsRangeInfo *out_range_info) {
+    Result rc;
+    FsFile file;
+    Entry *entry;
+    
+    if (R_FAILED((rc = this->Acquire(source, &file, &entry)))) {
+        return rc;
+    }
+    rc = fsFileOperateRange(&file, operation_type, offset, size, out_range_info);
+    this->Release(source, file, entry);
+    
+    return rc;
+}
+
+void RomFSFileCache::GetStats(RomFSFileCacheStats *out) const {
+    out->hits = this->num_hits;
+    out->misses = this->num_misses;
+    out->evictions = this->num_evictions;
+    out->ipcs_saved = out->hits * 2;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2018 Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <switch.h>
+#include <stratosphere.hpp>
+#include <atomic>
+
+#include "fsmitm_romfsbuild.hpp"
+#include "fs_shim.h"
+
+struct RomFSFileCacheStats {
+    u64 hits;
+    u64 misses;
+    u64 evictions;
+    /* Each hit saves both an open and a close. */
+    u64 ipcs_saved;
+};
+
+/* Keeps recently used SD files backing a LayeredRomFS open, so that reads don't need to open and close them. */
+class RomFSFileCache {
+    public:
+        static constexpr size_t MaxEntries = 8;
+    private:
+        struct Entry {
+            const RomFSSourceInfo *source;
+            FsFile file;
+            u64 last_used;
+            u32 ref_count;
+        };
+    private:
+        HosMutex lock;
+        u64 title_id;
+        u64 use_counter = 0;
+        Entry entries[MaxEntries] = {};
+        /* Statistics, readable without taking the lock. */
+        std::atomic<u64> num_hits = 0;
+        std::atomic<u64> num_misses = 0;
+        std::atomic<u64> num_evictions = 0;
+    private:
+        Result OpenFile(const RomFSSourceInfo *source, FsFile *out);
+        Entry *FindEntry(const RomFSSourceInfo *source);
+        Entry *FindFreeEntry();
+        Result Acquire(const RomFSSourceInfo *source, FsFile *out_file, Entry **out_entry);
+        void Release(const RomFSSourceInfo *source, FsFile file, Entry *entry);
+    public:
+        RomFSFileCache(u64 tid) : title_id(tid) { }
+        ~RomFSFileCache();
+
+        /* Source must be a LooseFile or MetaData source. Offset is relative to the start of the file. */
+        Result Read(const RomFSSourceInfo *source, u64 offset, void *buffer, size_t size, size_t *out_read);
+        Result OperateRange(const RomFSSourceInfo *source, u32 operation_type, u64 offset, u64 size, FsRangeInfo *out_range_info);
+        void GetStats(RomFSFileCacheStats *out) const;
+};
@@ -18,48 +18,100 @@
 #include <stratosphere.hpp>
 
 #include "fsmitm_layeredrom.hpp"
+#include "fsmitm_romfsindex.hpp"
 #include "../utils.hpp"
 #include "../debug.hpp"
 
 IStorage::~IStorage() = default;
 
-LayeredRomFS::LayeredRomFS(std::shared_ptr<RomInterfaceStorage> s_r, std::shared_ptr<RomFileStorage> f_r, u64 tid) : storage_romfs(s_r), file_romfs(f_r), title_id(tid) {
-    /* Start building the new virtual romfs. */
-    RomFSBuildContext build_ctx(this->title_id);
+static constexpr size_t RomFSTablePrefetchStackSize = 0x2000;
+
+struct RomFSTablePrefetch {
+    IROStorage *file_romfs;
+    IROStorage *storage_romfs;
+    RomFSStorageTables file_tables;
+    RomFSStorageTables base_tables;
+};
+
+static void PrefetchRomFSTables(void *arg) {
+    RomFSTablePrefetch *prefetch = reinterpret_cast<RomFSTablePrefetch *>(arg);
+    if (prefetch->file_romfs != nullptr) {
+        RomFSBuildContext::ReadRomStorageTables(prefetch->file_romfs, &prefetch->file_tables);
+    }
+    if (prefetch->storage_romfs != nullptr) {
+        RomFSBuildContext::ReadRomStorageTables(prefetch->storage_romfs, &prefetch->base_tables);
+    }
+}
+
+LayeredRomFS::LayeredRomFS(std::shared_ptr<RomInterfaceStorage> s_r, std::shared_ptr<RomFileStorage> f_r, u64 tid) : storage_romfs(s_r), file_romfs(f_r), title_id(tid), file_cache(tid) {
     this->p_source_infos = std::shared_ptr<std::vector<RomFSSourceInfo>>(new std::vector<RomFSSourceInfo>(), [](std::vector<RomFSSourceInfo> *to_delete) {
         for (unsigned int i = 0; i < to_delete->size(); i++) {
             (*to_delete)[i].Cleanup();
         }
         delete to_delete;
     });
+    
+    /* Try to reuse the layout from a previous launch, if nothing it depends on has changed. */
+    u8 fingerprint[ROMFS_INDEX_FINGERPRINT_SIZE];
+    u8 structure_fingerprint[ROMFS_INDEX_FINGERPRINT_SIZE];
+    const bool use_index = Utils::IsSdInitialized();
+    if (use_index) {
+        RomFSSdFileSizes sd_file_sizes;
+        RomFSIndex::CalculateFingerprint(this->title_id, this->file_romfs.get(), this->storage_romfs.get(), fingerprint, structure_fingerprint, &sd_file_sizes);
+        if (RomFSIndex::Load(this->title_id, fingerprint, this->p_source_infos.get())) {
+            return;
+        }
+        /* If only the sizes of SD files changed, the previous layout can be patched instead. */
+        if (RomFSIndex::Update(this->title_id, fingerprint, structure_fingerprint, &sd_file_sizes, this->p_source_infos.get())) {
+            return;
+        }
+        /* Never allow a stale index to be paired with the metadata we're about to write. */
+        RomFSIndex::Invalidate(this->title_id);
+    }
+    
+    /* Start building the new virtual romfs. */
+    RomFSBuildContext build_ctx(this->title_id);
+    RomFSTablePrefetch prefetch;
+    prefetch.file_romfs = this->file_romfs.get();
+    prefetch.storage_romfs = this->storage_romfs.get();
+    
+    /* Walking the SD card and reading the RomFS tables are independent, so read the tables on another thread meanwhile. */
+    /* Merging still happens in order (SD, then file, then base), so earlier sources take precedence as before. */
+    bool is_prefetching = false;
+    HosThread prefetch_thread;
     if (Utils::IsSdInitialized()) {
+        Result rc;
+        u32 priority;
+        if (R_SUCCEEDED(svcGetThreadPriority(&priority, CUR_THREAD_HANDLE)) && R_SUCCEEDED(prefetch_thread.Initialize(&PrefetchRomFSTables, &prefetch, RomFSTablePrefetchStackSize, priority))) {
+            if (R_FAILED((rc = prefetch_thread.Start()))) {
+                fatalSimple(rc);
+            }
+            is_prefetching = true;
+        }
         build_ctx.MergeSdFiles();
     }
-    if (this->file_romfs) {
-        build_ctx.MergeRomStorage(this->file_romfs.get(), RomFSDataSource::FileRomFS);
+    if (is_prefetching) {
+        prefetch_thread.Join();
+    } else {
+        PrefetchRomFSTables(&prefetch);
     }
-    if (this->storage_romfs) {
-        build_ctx.MergeRomStorage(this->storage_romfs.get(), RomFSDataSource::BaseRomFS);
+    build_ctx.MergeRomStorageTables(&prefetch.file_tables, RomFSDataSource::FileRomFS);
+    build_ctx.MergeRomStorageTables(&prefetch.base_tables, RomFSDataSource::BaseRomFS);
+    std::vector<RomFSManifestEntry> manifest;
+    build_ctx.Build(this->p_source_infos.get(), use_index ? &manifest : nullptr);
+    
+    if (use_index) {
+        RomFSIndex::Save(this->title_id, fingerprint, structure_fingerprint, this->p_source_infos.get(), &manifest);
     }
-    build_ctx.Build(this->p_source_infos.get());
 }
 
 
-Result LayeredRomFS::Read(void *buffer, size_t size, u64 offset)  {
-    /* Size zero reads should always succeed. */
-    if (size == 0) {
-        return 0;
-    }
-    
-    /* Validate size. */
-    u64 virt_size = (*this->p_source_infos)[this->p_source_infos->size() - 1].virtual_offset + (*this->p_source_infos)[this->p_source_infos->size() - 1].size;
-    if (offset >= virt_size) {
-        return 0x2F5A02;
-    }
-    if (virt_size - offset < size) {
-        size = virt_size - offset;
-    }
-    /* Find first source info via binary search. */
+u64 LayeredRomFS::GetVirtualSize() const {
+    return this->p_source_infos->back().virtual_offset + this->p_source_infos->back().size;
+}
+
+u32 LayeredRomFS::FindSourceIndex(u64 offset) const {
+    /* Find the last source info starting at or before offset, via binary search. */
     u32 cur_source_ind = 0;
     u32 low = 0, high = this->p_source_infos->size() - 1;
     while (low <= high) {
@@ -77,95 +129,264 @@ Result LayeredRomFS::Read(void *buffer, size_t size, u64 offset)  {
             low = mid + 1;
         }
     }
+    return cur_source_ind;
+}
+
+const RomFSSourceInfo *LayeredRomFS::FindSingleSource(u64 offset, u64 size) const {
+    if (size == 0 || offset >= this->GetVirtualSize()) {
+        return nullptr;
+    }
+    const RomFSSourceInfo *source = &((*this->p_source_infos)[this->FindSourceIndex(offset)]);
+    if (offset - source->virtual_offset >= source->size || size > source->size - (offset - source->virtual_offset)) {
+        return nullptr;
+    }
+    return source;
+}
+
+void LayeredRomFS::GetStats(LayeredRomFSStats *out) const {
+    out->reads = this->num_reads;
+    out->direct_reads = this->num_direct_reads;
+    for (size_t i = 0; i < RomFSDataSourceCount; i++) {
+        out->source_bytes[i] = this->source_bytes[i];
+    }
+    out->padding_bytes = this->padding_bytes;
+    this->file_cache.GetStats(&out->file_cache);
+    if (this->file_romfs != nullptr) {
+        this->file_romfs->GetStats(&out->file_romfs);
+    } else {
+        out->file_romfs = {};
+    }
+}
+
+Result LayeredRomFS::Read(void *buffer, size_t size, u64 offset)  {
+    /* Size zero reads should always succeed. */
+    if (size == 0) {
+        return 0;
+    }
+    
+    /* Validate size. */
+    u64 virt_size = this->GetVirtualSize();
+    if (offset >= virt_size) {
+        return 0x2F5A02;
+    }
+    if (virt_size - offset < size) {
+        size = virt_size - offset;
+    }
     
+    this->num_reads++;
+    
+    /* Reads from unmodified RomFS regions can go straight to the backing storage, into the caller's buffer. */
+    const RomFSSourceInfo *single_source = this->FindSingleSource(offset, size);
+    if (single_source != nullptr && (single_source->type == RomFSDataSource::BaseRomFS || single_source->type == RomFSDataSource::FileRomFS)) {
+        const u64 source_offset = single_source->base_source_info.offset + (offset - single_source->virtual_offset);
+        if (single_source->type == RomFSDataSource::BaseRomFS) {
+            this->num_direct_reads++;
+            this->source_bytes[static_cast<size_t>(RomFSDataSource::BaseRomFS)] += size;
+            return this->storage_romfs->Read(buffer, size, source_offset);
+        } else {
+            Result rc;
+            this->num_direct_reads++;
+            this->source_bytes[static_cast<size_t>(RomFSDataSource::FileRomFS)] += size;
+            if (R_FAILED((rc = this->file_romfs->Read(buffer, size, source_offset)))) {
+                fatalSimple(rc);
+            }
+            return rc;
+        }
+    }
+    
+    /* Plan the read a batch of segments at a time, then issue one backend read per segment. */
     Result rc;
+    ReadSegment segments[MaxReadSegments];
+    u32 cur_source_ind = this->FindSourceIndex(offset);
     size_t read_so_far = 0;
     while (read_so_far < size) {
-        RomFSSourceInfo *cur_source = &((*this->p_source_infos)[cur_source_ind]);
-        if (cur_source->virtual_offset + cur_source->size > offset) {
-            u64 cur_read_size = size - read_so_far;
-            if (cur_read_size > cur_source->size - (offset - cur_source->virtual_offset)) {
-                cur_read_size = cur_source->size - (offset - cur_source->virtual_offset);
+        const size_t num_segments = this->PlanRead(&cur_source_ind, &offset, &read_so_far, size, segments);
+        for (size_t i = 0; i < num_segments; i++) {
+            if (R_FAILED((rc = this->ExecuteReadSegment(buffer, &segments[i])))) {
+                return rc;
+            }
+        }
+    }
+    
+    return 0;
+}
+
+size_t LayeredRomFS::PlanRead(u32 *cur_source_ind, u64 *offset, size_t *read_so_far, size_t size, ReadSegment *out_segments) const {
+    size_t num_segments = 0;
+    while (*read_so_far < size && num_segments < MaxReadSegments) {
+        const RomFSSourceInfo *cur_source = &((*this->p_source_infos)[*cur_source_ind]);
+        ReadSegment cur_segment;
+        cur_segment.buffer_offset = *read_so_far;
+        if (cur_source->virtual_offset + cur_source->size > *offset) {
+            cur_segment.source = cur_source;
+            cur_segment.source_offset = *offset - cur_source->virtual_offset;
+            cur_segment.size = size - *read_so_far;
+            if (cur_segment.size > cur_source->size - cur_segment.source_offset) {
+                cur_segment.size = cur_source->size - cur_segment.source_offset;
             }
-            switch (cur_source->type) {
-                case RomFSDataSource::MetaData:
-                    {
-                        FsFile file;
-                        if (R_FAILED((rc = Utils::OpenSdFileForAtmosphere(this->title_id, ROMFS_METADATA_FILE_PATH, FS_OPEN_READ, &file)))) {
-                            fatalSimple(rc);
-                        }
-                        size_t out_read;
-                        if (R_FAILED((rc = fsFileRead(&file, (offset - cur_source->virtual_offset), (void *)((uintptr_t)buffer + read_so_far), cur_read_size, &out_read)))) {
-                            fatalSimple(rc);
-                        }
-                        if (out_read != cur_read_size) {
-                            Reboot();
-                        }
-                        fsFileClose(&file);
-                    }
-                    break;
-                case RomFSDataSource::LooseFile:
-                    {
-                        FsFile file;
-                        if (R_FAILED((rc = Utils::OpenRomFSSdFile(this->title_id, cur_source->loose_source_info.path, FS_OPEN_READ, &file)))) {
-                            fatalSimple(rc);
-                        }
-                        size_t out_read;
-                        if (R_FAILED((rc = fsFileRead(&file, (offset - cur_source->virtual_offset), (void *)((uintptr_t)buffer + read_so_far), cur_read_size, &out_read)))) {
-                            fatalSimple(rc);
-                        }
-                        if (out_read != cur_read_size) {
-                            Reboot();
-                        }
-                        fsFileClose(&file);
-                    }
-                    break;
-                case RomFSDataSource::Memory:
-                    {
-                        memcpy((void *)((uintptr_t)buffer + read_so_far), cur_source->memory_source_info.data + (offset - cur_source->virtual_offset), cur_read_size);
-                    }
-                    break;
-                case RomFSDataSource::BaseRomFS:
-                    {
-                        if (R_FAILED((rc = this->storage_romfs->Read((void *)((uintptr_t)buffer + read_so_far), cur_read_size, cur_source->base_source_info.offset + (offset - cur_source->virtual_offset))))) {
-                            /* TODO: Can this ever happen? */
-                            /* fatalSimple(rc); */
-                            return rc;
-                        }
-                    }
-                    break;
-                case RomFSDataSource::FileRomFS:
-                    {
-                        if (R_FAILED((rc = this->file_romfs->Read((void *)((uintptr_t)buffer + read_so_far), cur_read_size, cur_source->base_source_info.offset + (offset - cur_source->virtual_offset))))) {
-                            fatalSimple(rc);
-                        }
-                    }
-                    break;
-                default:
-                    fatalSimple(0xF601);
+            if (cur_source->type == RomFSDataSource::BaseRomFS || cur_source->type == RomFSDataSource::FileRomFS) {
+                cur_segment.source_offset += cur_source->base_source_info.offset;
             }
-            read_so_far += cur_read_size;
-            offset += cur_read_size;
         } else {
-            /* Handle padding explicitly. */
-            cur_source_ind++;
-            /* Zero out the padding we skip, here. */
-            memset((void *)((uintptr_t)buffer + read_so_far), 0, ((*this->p_source_infos)[cur_source_ind]).virtual_offset - offset);
-            read_so_far += ((*this->p_source_infos)[cur_source_ind]).virtual_offset - offset;
-            offset = ((*this->p_source_infos)[cur_source_ind]).virtual_offset;
+            /* Handle padding explicitly, it's zero-filled when executed. */
+            (*cur_source_ind)++;
+            cur_segment.source = nullptr;
+            cur_segment.source_offset = 0;
+            cur_segment.size = (*this->p_source_infos)[*cur_source_ind].virtual_offset - *offset;
+            if (cur_segment.size > size - *read_so_far) {
+                cur_segment.size = size - *read_so_far;
+            }
+            /* Contiguous sources have no padding between them, and empty segments would only use up slots. */
+            if (cur_segment.size == 0) {
+                continue;
+            }
+        }
+        *read_so_far += cur_segment.size;
+        *offset += cur_segment.size;
+        
+        /* Merge with the previous segment, if the backend data is contiguous. */
+        /* Padding in between is never merged over, as it must read as zeros rather than as whatever the backend holds there. */
+        if (cur_segment.source != nullptr && (cur_segment.source->type == RomFSDataSource::BaseRomFS || cur_segment.source->type == RomFSDataSource::FileRomFS)) {
+            ReadSegment *prev = num_segments >= 1 ? &out_segments[num_segments - 1] : nullptr;
+            if (prev != nullptr && prev->source != nullptr && prev->source->type == cur_segment.source->type && prev->source_offset + prev->size == cur_segment.source_offset) {
+                prev->size += cur_segment.size;
+                continue;
+            }
+        } else if (cur_segment.source == nullptr && num_segments >= 1 && out_segments[num_segments - 1].source == nullptr) {
+            out_segments[num_segments - 1].size += cur_segment.size;
+            continue;
         }
+        
+        out_segments[num_segments++] = cur_segment;
+    }
+    return num_segments;
+}
+
+Result LayeredRomFS::ExecuteReadSegment(void *buffer, const ReadSegment *segment) {
+    Result rc;
+    void *cur_buffer = (void *)((uintptr_t)buffer + segment->buffer_offset);
+    
+    if (segment->source == nullptr) {
+        memset(cur_buffer, 0, segment->size);
+        this->padding_bytes += segment->size;
+        return 0;
+    }
+    
+    switch (segment->source->type) {
+        case RomFSDataSource::MetaData:
+        case RomFSDataSource::LooseFile:
+            {
+                /* Each file backs a single source, so this is the only time the call touches its handle. */
+                size_t out_read;
+                if (R_FAILED((rc = this->file_cache.Read(segment->source, segment->source_offset, cur_buffer, segment->size, &out_read)))) {
+                    fatalSimple(rc);
+                }
+                if (out_read != segment->size) {
+                    Reboot();
+                }
+            }
+            break;
+        case RomFSDataSource::Memory:
+            {
+                memcpy(cur_buffer, segment->source->memory_source_info.data + segment->source_offset, segment->size);
+            }
+            break;
+        case RomFSDataSource::BaseRomFS:
+            {
+                if (R_FAILED((rc = this->storage_romfs->Read(cur_buffer, segment->size, segment->source_offset)))) {
+                    /* TODO: Can this ever happen? */
+                    /* fatalSimple(rc); */
+                    return rc;
+                }
+            }
+            break;
+        case RomFSDataSource::FileRomFS:
+            {
+                if (R_FAILED((rc = this->file_romfs->Read(cur_buffer, segment->size, segment->source_offset)))) {
+                    fatalSimple(rc);
+                }
+            }
+            break;
+        default:
+            fatalSimple(0xF601);
     }
     
+    this->source_bytes[static_cast<size_t>(segment->source->type)] += segment->size;
     return 0;
 }
+
 Result LayeredRomFS::GetSize(u64 *out_size)  {
-    *out_size = (*this->p_source_infos)[this->p_source_infos->size() - 1].virtual_offset + (*this->p_source_infos)[this->p_source_infos->size() - 1].size;
+    *out_size = this->GetVirtualSize();
     return 0x0;
 }
+
 Result LayeredRomFS::OperateRange(u32 operation_type, u64 offset, u64 size, FsRangeInfo *out_range_info) {
-    /* TODO: How should I implement this for a virtual romfs? */
-    if (operation_type == 3) {
+    /* Query range (3) merges the info of every source, other operations simply apply to each. */
+    const bool is_query = operation_type == 3;
+    if (is_query) {
         *out_range_info = {0};
     }
+    if (size == 0) {
+        return 0;
+    }
+    
+    /* Validate size. */
+    u64 virt_size = this->GetVirtualSize();
+    if (offset >= virt_size) {
+        return 0x2F5A02;
+    }
+    if (virt_size - offset < size) {
+        size = virt_size - offset;
+    }
+    
+    Result rc;
+    u32 cur_source_ind = this->FindSourceIndex(offset);
+    const u64 end = offset + size;
+    while (offset < end && cur_source_ind < this->p_source_infos->size()) {
+        const RomFSSourceInfo *cur_source = &((*this->p_source_infos)[cur_source_ind++]);
+        if (cur_source->virtual_offset >= end) {
+            break;
+        }
+        if (cur_source->virtual_offset + cur_source->size <= offset) {
+            continue;
+        }
+        
+        /* Skip over any padding before this source. */
+        offset = std::max(offset, cur_source->virtual_offset);
+        const u64 source_ofs = offset - cur_source->virtual_offset;
+        const u64 cur_size = std::min(end - offset, cur_source->size - source_ofs);
+        
+        FsRangeInfo cur_info = {0};
+        switch (cur_source->type) {
+            case RomFSDataSource::BaseRomFS:
+                rc = this->storage_romfs->OperateRange(operation_type, cur_source->base_source_info.offset + source_ofs, cur_size, &cur_info);
+                break;
+            case RomFSDataSource::FileRomFS:
+                rc = this->file_romfs->OperateRange(operation_type, cur_source->file_source_info.offset + source_ofs, cur_size, &cur_info);
+                break;
+            case RomFSDataSource::MetaData:
+            case RomFSDataSource::LooseFile:
+                rc = this->file_cache.OperateRange(cur_source, operation_type, source_ofs, cur_size, &cur_info);
+                break;
+            case RomFSDataSource::Memory:
+                /* There's nothing to invalidate or query for data we hold ourselves. */
+                rc = 0;
+                break;
+            default:
+                fatalSimple(0xF601);
+        }
+        if (R_FAILED(rc)) {
+            return rc;
+        }
+        
+        if (is_query) {
+            for (size_t i = 0; i < sizeof(cur_info.flags) / sizeof(cur_info.flags[0]); i++) {
+                out_range_info->flags[i] |= cur_info.flags[i];
+            }
+        }
+        
+        offset += cur_size;
+    }
+    
     return 0;
 }
@@ -18,11 +18,26 @@
 #include <switch.h>
 #include <stratosphere.hpp>
 
+#include <atomic>
+
 #include "fsmitm_romstorage.hpp"
 #include "fsmitm_romfsbuild.hpp"
+#include "fsmitm_filecache.hpp"
 #include "../utils.hpp"
 
 
+struct LayeredRomFSStats {
+    u64 reads;
+    /* Reads served by a single base or file RomFS source, without planning. */
+    u64 direct_reads;
+    /* Bytes served, indexed by RomFSDataSource. */
+    u64 source_bytes[RomFSDataSourceCount];
+    u64 padding_bytes;
+    RomFSFileCacheStats file_cache;
+    /* Zero if there is no romfs.bin. */
+    RomFileStorageStats file_romfs;
+};
+
 /* Represents a merged RomFS. */
 class LayeredRomFS : public IROStorage {
     private:
@@ -32,11 +47,36 @@ class LayeredRomFS : public IROStorage {
         /* Information about the merged RomFS. */
         u64 title_id;
         std::shared_ptr<std::vector<RomFSSourceInfo>> p_source_infos;
-                
+        /* Open handles for SD-backed sources. */
+        RomFSFileCache file_cache;
+        /* Read statistics, updated from every thread reading from us. */
+        std::atomic<u64> num_reads = 0;
+        std::atomic<u64> num_direct_reads = 0;
+        std::atomic<u64> source_bytes[RomFSDataSourceCount] = {};
+        std::atomic<u64> padding_bytes = 0;
+    private:
+        /* A contiguous piece of a read, backed by one source (or by padding, when source is nullptr). */
+        struct ReadSegment {
+            const RomFSSourceInfo *source;
+            /* Absolute offset for BaseRomFS/FileRomFS sources, relative to the source otherwise. */
+            u64 source_offset;
+            size_t buffer_offset;
+            size_t size;
+        };
+        static constexpr size_t MaxReadSegments = 0x20;
+    private:
+        u64 GetVirtualSize() const;
+        u32 FindSourceIndex(u64 offset) const;
+        size_t PlanRead(u32 *cur_source_ind, u64 *offset, size_t *read_so_far, size_t size, ReadSegment *out_segments) const;
+        Result ExecuteReadSegment(void *buffer, const ReadSegment *segment);
     public:
         LayeredRomFS(std::shared_ptr<RomInterfaceStorage> s_r, std::shared_ptr<RomFileStorage> f_r, u64 tid);
         virtual ~LayeredRomFS() = default;
         
+        /* Returns the source backing all of [offset, offset + size), or nullptr if there is no single such source. */
+        const RomFSSourceInfo *FindSingleSource(u64 offset, u64 size) const;
+        void GetStats(LayeredRomFSStats *out) const;
+        
         virtual Result Read(void *buffer, size_t size, u64 offset) override;
         virtual Result GetSize(u64 *out_size) override;
         virtual Result OperateRange(u32 operation_type, u64 offset, u64 size, FsRangeInfo *out_range_info) override;
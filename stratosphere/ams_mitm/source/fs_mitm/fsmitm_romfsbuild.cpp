@@ -16,6 +16,7 @@
  
 #include <switch.h>
 #include <string.h>
+#include <algorithm>
 #include <stratosphere.hpp>
 #include "../utils.hpp"
 #include "fsmitm_romfsbuild.hpp"
@@ -26,63 +27,40 @@ void RomFSBuildContext::VisitDirectory(FsFileSystem *filesys, RomFSBuildDirector
     FsDir dir;
     Result rc;
     
-    std::vector<RomFSBuildDirectoryContext *> child_dirs;
+    /* Walk the tree with an explicit stack, reading entries in batches into a single buffer. */
+    std::vector<RomFSBuildDirectoryContext *> dir_stack;
+    auto dir_entries = std::make_unique<FsDirectoryEntry[]>(DirectoryEntryBatchCount);
+    dir_stack.push_back(parent);
     
-    /* Open the current parent directory. */
-    if (R_FAILED((rc = Utils::OpenRomFSDir(filesys, this->title_id, parent->path, &dir)))) {
-        fatalSimple(rc);
-    }
-    
-    u64 read_entries;
-    while (R_SUCCEEDED((rc = fsDirRead(&dir, 0, &read_entries, 1, &this->dir_entry))) && read_entries == 1) {
-        if (this->dir_entry.type == ENTRYTYPE_DIR) {
-            RomFSBuildDirectoryContext *child = new RomFSBuildDirectoryContext({0});
-            /* Set child's path. */
-            child->cur_path_ofs = parent->path_len + 1;
-            child->path_len = child->cur_path_ofs + strlen(this->dir_entry.name);
-            child->path = new char[child->path_len + 1];
-            strcpy(child->path, parent->path);
-            if (child->path_len > FS_MAX_PATH - 1) {
-                fatalSimple(0xF601);
-            }
-            strcat(child->path + parent->path_len, "/");
-            strcat(child->path + parent->path_len, this->dir_entry.name);
-                                    
-            if (!this->AddDirectory(parent, child, NULL)) {
-                delete child->path;
-                delete child;
-            } else {
-                child_dirs.push_back(child);
-            }
-        } else if (this->dir_entry.type == ENTRYTYPE_FILE) {
-            RomFSBuildFileContext *child = new RomFSBuildFileContext({0});
-            /* Set child's path. */
-            child->cur_path_ofs = parent->path_len + 1;
-            child->path_len = child->cur_path_ofs + strlen(this->dir_entry.name);
-            child->path = new char[child->path_len + 1];
-            strcpy(child->path, parent->path);
-            if (child->path_len > FS_MAX_PATH - 1) {
-                fatalSimple(0xF601);
-            }
-            strcat(child->path + parent->path_len, "/");
-            strcat(child->path + parent->path_len, this->dir_entry.name);
-            
-            child->source = this->cur_source_type;
-            
-            child->size = this->dir_entry.fileSize;
-                                    
-            if (!this->AddFile(parent, child)) {
-                delete child->path;
-                delete child;
-            }
-        } else {
+    while (!dir_stack.empty()) {
+        RomFSBuildDirectoryContext *cur_dir = dir_stack.back();
+        dir_stack.pop_back();
+        
+        /* Open the current directory. */
+        romfs_build_path(this->path_buf, cur_dir->parent, cur_dir->name, cur_dir->name_size, cur_dir->path_len);
+        if (R_FAILED((rc = Utils::OpenRomFSDir(filesys, this->title_id, this->path_buf, &dir)))) {
             fatalSimple(rc);
         }
-    }
-    fsDirClose(&dir);
-    
-    for (auto &child : child_dirs) {
-        this->VisitDirectory(filesys, child);
+        
+        u64 read_entries;
+        while (R_SUCCEEDED((rc = fsDirRead(&dir, 0, &read_entries, DirectoryEntryBatchCount, dir_entries.get()))) && read_entries > 0) {
+            for (u64 i = 0; i < read_entries; i++) {
+                const FsDirectoryEntry *cur_entry = &dir_entries[i];
+                const u32 name_size = strlen(cur_entry->name);
+                if (cur_dir->path_len + 1 + name_size > FS_MAX_PATH - 1) {
+                    fatalSimple(0xF601);
+                }
+                
+                if (cur_entry->type == ENTRYTYPE_DIR) {
+                    dir_stack.push_back(this->AddDirectory(cur_dir, cur_entry->name, name_size));
+                } else if (cur_entry->type == ENTRYTYPE_FILE) {
+                    this->AddFile(cur_dir, cur_entry->name, name_size, cur_entry->fileSize, 0);
+                } else {
+                    fatalSimple(0xF601);
+                }
+            }
+        }
+        fsDirClose(&dir);
     }
 }
 
@@ -104,61 +82,54 @@ void RomFSBuildContext::MergeSdFiles() {
     fsFsClose(&sd_filesystem);
 }
 
+/* Base RomFS tables come from the game, so every entry is bounds checked before it is used. */
+static RomFSDirectoryEntry *romfs_get_checked_direntry(void *dir_table, size_t dir_table_size, u32 offset) {
+    if ((offset & 3) != 0 || dir_table_size < sizeof(RomFSDirectoryEntry) || offset > dir_table_size - sizeof(RomFSDirectoryEntry)) {
+        fatalSimple(0xF601);
+    }
+    RomFSDirectoryEntry *entry = romfs_get_direntry(dir_table, offset);
+    if (entry->name_size > dir_table_size - sizeof(RomFSDirectoryEntry) - offset) {
+        fatalSimple(0xF601);
+    }
+    return entry;
+}
+
+static RomFSFileEntry *romfs_get_checked_fentry(void *file_table, size_t file_table_size, u32 offset) {
+    if ((offset & 3) != 0 || file_table_size < sizeof(RomFSFileEntry) || offset > file_table_size - sizeof(RomFSFileEntry)) {
+        fatalSimple(0xF601);
+    }
+    RomFSFileEntry *entry = romfs_get_fentry(file_table, offset);
+    if (entry->name_size > file_table_size - sizeof(RomFSFileEntry) - offset || entry->offset + entry->size < entry->offset) {
+        fatalSimple(0xF601);
+    }
+    return entry;
+}
+
 void RomFSBuildContext::VisitDirectory(RomFSBuildDirectoryContext *parent, u32 parent_offset, void *dir_table, size_t dir_table_size, void *file_table, size_t file_table_size) {
-    RomFSDirectoryEntry *parent_entry = romfs_get_direntry(dir_table, parent_offset);
+    RomFSDirectoryEntry *parent_entry = romfs_get_checked_direntry(dir_table, dir_table_size, parent_offset);
     if (parent_entry->file != ROMFS_ENTRY_EMPTY) {
-        RomFSFileEntry *cur_file = romfs_get_fentry(file_table, parent_entry->file);
+        RomFSFileEntry *cur_file = romfs_get_checked_fentry(file_table, file_table_size, parent_entry->file);
         while (cur_file != NULL) {
-            RomFSBuildFileContext *child = new RomFSBuildFileContext({0});
-            /* Set child's path. */
-            child->cur_path_ofs = parent->path_len + 1;
-            child->path_len = child->cur_path_ofs + cur_file->name_size;
-            child->path = new char[child->path_len + 1];
-            strcpy(child->path, parent->path);
-            if (child->path_len > FS_MAX_PATH - 1) {
+            if (parent->path_len + 1 + cur_file->name_size > FS_MAX_PATH - 1 || this->num_table_entries_left-- == 0) {
                 fatalSimple(0xF601);
             }
-            strcat(child->path + parent->path_len, "/");
-            strncat(child->path + parent->path_len, cur_file->name, cur_file->name_size);
-            child->size = cur_file->size;
-            
-            child->source = this->cur_source_type;
-            child->orig_offset = cur_file->offset;
-            if (!this->AddFile(parent, child)) {
-                delete child->path;
-                delete child;
-            }
+            this->AddFile(parent, cur_file->name, cur_file->name_size, cur_file->size, cur_file->offset);
             if (cur_file->sibling == ROMFS_ENTRY_EMPTY) {
                 cur_file = NULL;
             } else {
-                cur_file = romfs_get_fentry(file_table, cur_file->sibling);
+                cur_file = romfs_get_checked_fentry(file_table, file_table_size, cur_file->sibling);
             }
         }
     }
     if (parent_entry->child != ROMFS_ENTRY_EMPTY) {
-        RomFSDirectoryEntry *cur_child = romfs_get_direntry(dir_table, parent_entry->child);
+        RomFSDirectoryEntry *cur_child = romfs_get_checked_direntry(dir_table, dir_table_size, parent_entry->child);
         u32 cur_child_offset = parent_entry->child;
         while (cur_child != NULL) {
-            RomFSBuildDirectoryContext *child = new RomFSBuildDirectoryContext({0});
-            /* Set child's path. */
-            child->cur_path_ofs = parent->path_len + 1;
-            child->path_len = child->cur_path_ofs + cur_child->name_size;
-            child->path = new char[child->path_len + 1];
-            strcpy(child->path, parent->path);
-            if (child->path_len > FS_MAX_PATH - 1) {
-                fatalSimple(0xF601);
-            }
-            strcat(child->path + parent->path_len, "/");
-            strncat(child->path + parent->path_len, cur_child->name, cur_child->name_size);
-            
-            RomFSBuildDirectoryContext *real = NULL;
-            if (!this->AddDirectory(parent, child, &real)) {
-                delete child->path;
-                delete child;
-            }
-            if (real == NULL) {
+            /* The path length limit also bounds recursion depth, should the table contain a cycle. */
+            if (parent->path_len + 1 + cur_child->name_size > FS_MAX_PATH - 1 || this->num_table_entries_left-- == 0) {
                 fatalSimple(0xF601);
             }
+            RomFSBuildDirectoryContext *real = this->AddDirectory(parent, cur_child->name, cur_child->name_size);
             
             this->VisitDirectory(real, cur_child_offset, dir_table, dir_table_size, file_table, file_table_size);
             
@@ -166,15 +137,17 @@ void RomFSBuildContext::VisitDirectory(RomFSBuildDirectoryContext *parent, u32 p
                 cur_child = NULL;
             } else {
                 cur_child_offset = cur_child->sibling;
-                cur_child = romfs_get_direntry(dir_table, cur_child->sibling);
+                cur_child = romfs_get_checked_direntry(dir_table, dir_table_size, cur_child->sibling);
             }
         }
     }
 }
 
-void RomFSBuildContext::MergeRomStorage(IROStorage *storage, RomFSDataSource source) {
+void RomFSBuildContext::ReadRomStorageTables(IROStorage *storage, RomFSStorageTables *out) {
     Result rc;
     RomFSHeader header;
+    u64 storage_size;
+    out->is_valid = false;
     if (R_FAILED((rc = storage->Read(&header, sizeof(header), 0)))) {
         fatalSimple(rc);
     }
@@ -182,60 +155,163 @@ void RomFSBuildContext::MergeRomStorage(IROStorage *storage, RomFSDataSource sou
         /* what */
         return;
     }
+    if (R_FAILED((rc = storage->GetSize(&storage_size)))) {
+        fatalSimple(rc);
+    }
+    
+    /* Don't trust table extents we can't actually read. */
+    if (header.dir_table_ofs > storage_size || header.dir_table_size > storage_size - header.dir_table_ofs || header.dir_table_size < sizeof(RomFSDirectoryEntry)) {
+        return;
+    }
+    if (header.file_table_ofs > storage_size || header.file_table_size > storage_size - header.file_table_ofs) {
+        return;
+    }
     
     /* Read tables. */
-    auto dir_table = std::make_unique<u8[]>(header.dir_table_size);
-    auto file_table = std::make_unique<u8[]>(header.file_table_size);
-    if (R_FAILED((rc = storage->Read(dir_table.get(), header.dir_table_size, header.dir_table_ofs)))) {
+    out->dir_table = std::make_unique<u8[]>(header.dir_table_size);
+    out->file_table = std::make_unique<u8[]>(header.file_table_size);
+    out->dir_table_size = header.dir_table_size;
+    out->file_table_size = header.file_table_size;
+    if (R_FAILED((rc = storage->Read(out->dir_table.get(), header.dir_table_size, header.dir_table_ofs)))) {
         fatalSimple(rc);
     }
-    if (R_FAILED((rc = storage->Read(file_table.get(), header.file_table_size, header.file_table_ofs)))) {
+    if (R_FAILED((rc = storage->Read(out->file_table.get(), header.file_table_size, header.file_table_ofs)))) {
         fatalSimple(rc);
     }
+    out->is_valid = true;
+}
+
+void RomFSBuildContext::MergeRomStorageTables(RomFSStorageTables *tables, RomFSDataSource source) {
+    if (!tables->is_valid) {
+        return;
+    }
     
+    /* A well-formed table visits each entry once, so anything past that is a sibling cycle. */
+    this->num_table_entries_left = tables->dir_table_size / sizeof(RomFSDirectoryEntry) + tables->file_table_size / sizeof(RomFSFileEntry);
     this->cur_source_type = source;
-    this->VisitDirectory(this->root, 0x0, dir_table.get(), (size_t)header.dir_table_size, file_table.get(), (size_t)header.file_table_size);
+    this->VisitDirectory(this->root, 0x0, tables->dir_table.get(), tables->dir_table_size, tables->file_table.get(), tables->file_table_size);
 }
 
-bool RomFSBuildContext::AddDirectory(RomFSBuildDirectoryContext *parent_dir_ctx, RomFSBuildDirectoryContext *dir_ctx, RomFSBuildDirectoryContext **out_dir_ctx) {
+void RomFSBuildContext::MergeRomStorage(IROStorage *storage, RomFSDataSource source) {
+    RomFSStorageTables tables;
+    ReadRomStorageTables(storage, &tables);
+    this->MergeRomStorageTables(&tables, source);
+}
+
+RomFSBuildDirectoryContext *RomFSBuildContext::AddDirectory(RomFSBuildDirectoryContext *parent_dir_ctx, const char *name, u32 name_size) {
     /* Check whether it's already in the known directories. */
-    auto existing = this->directories.find(dir_ctx->path);
-    if (existing != this->directories.end()) {
-        if (out_dir_ctx) {
-            *out_dir_ctx = existing->second;
-        }
-        return false;
+    const u32 hash = RomFSBuildIndex<RomFSBuildDirectoryContext>::Hash(parent_dir_ctx, name, name_size);
+    RomFSBuildDirectoryContext *existing = this->directories.Find(parent_dir_ctx, name, name_size, hash);
+    if (existing != NULL) {
+        return existing;
     }
     
     /* Add a new directory. */
-    this->num_dirs++;
-    this->dir_table_size += sizeof(RomFSDirectoryEntry) + ((dir_ctx->path_len - dir_ctx->cur_path_ofs + 3) & ~3);
+    RomFSBuildDirectoryContext *dir_ctx = this->arena.New<RomFSBuildDirectoryContext>();
+    dir_ctx->name = this->arena.CopyName(name, name_size);
+    dir_ctx->name_size = name_size;
+    dir_ctx->path_len = parent_dir_ctx->path_len + 1 + name_size;
+    dir_ctx->index_hash = hash;
     dir_ctx->parent = parent_dir_ctx;
-    this->directories.insert({dir_ctx->path, dir_ctx});
     
-    if (out_dir_ctx) {
-        *out_dir_ctx = dir_ctx;
-    }
-    return true;
+    /* Link into the parent's child list. This is unsorted until Build(). */
+    dir_ctx->sibling = parent_dir_ctx->child;
+    parent_dir_ctx->child = dir_ctx;
+    
+    this->num_dirs++;
+    this->dir_table_size += sizeof(RomFSDirectoryEntry) + ((name_size + 3) & ~3);
+    this->directories.Insert(dir_ctx);
+    
+    return dir_ctx;
 }
 
-bool RomFSBuildContext::AddFile(RomFSBuildDirectoryContext *parent_dir_ctx, RomFSBuildFileContext *file_ctx) {
+void RomFSBuildContext::AddFile(RomFSBuildDirectoryContext *parent_dir_ctx, const char *name, u32 name_size, u64 size, u64 orig_offset) {
     /* Check whether it's already in the known files. */
-    auto existing = this->files.find(file_ctx->path);
-    if (existing != this->files.end()) {
-        return false;
+    const u32 hash = RomFSBuildIndex<RomFSBuildFileContext>::Hash(parent_dir_ctx, name, name_size);
+    if (this->files.Find(parent_dir_ctx, name, name_size, hash) != NULL) {
+        return;
     }
     
     /* Add a new file. */
-    this->num_files++;
-    this->file_table_size += sizeof(RomFSFileEntry) + ((file_ctx->path_len - file_ctx->cur_path_ofs + 3) & ~3);
+    RomFSBuildFileContext *file_ctx = this->arena.New<RomFSBuildFileContext>();
+    file_ctx->name = this->arena.CopyName(name, name_size);
+    file_ctx->name_size = name_size;
+    file_ctx->path_len = parent_dir_ctx->path_len + 1 + name_size;
+    file_ctx->index_hash = hash;
+    file_ctx->size = size;
+    file_ctx->source = this->cur_source_type;
+    file_ctx->orig_offset = orig_offset;
     file_ctx->parent = parent_dir_ctx;
-    this->files.insert({file_ctx->path, file_ctx});
     
-    return true;
+    /* Link into the parent's file list. This is unsorted until Build(). */
+    file_ctx->sibling = parent_dir_ctx->file;
+    parent_dir_ctx->file = file_ctx;
+    
+    this->num_files++;
+    this->file_table_size += sizeof(RomFSFileEntry) + ((name_size + 3) & ~3);
+    this->files.Insert(file_ctx);
+}
+
+/* Entries must be laid out in strcmp order of their full paths. Within a directory, an entry's */
+/* position is given by its name followed by NUL for the entry itself, or by '/' for everything beneath it. */
+struct RomFSBuildSortItem {
+    const char *name;
+    u32 name_size;
+    u8 terminator;
+    void *ctx;
+};
+
+static bool RomFSBuildSortItemLess(const RomFSBuildSortItem &a, const RomFSBuildSortItem &b) {
+    const u32 min_size = std::min(a.name_size, b.name_size);
+    const int cmp = memcmp(a.name, b.name, min_size);
+    if (cmp != 0) {
+        return cmp < 0;
+    }
+    const u8 a_next = a.name_size > min_size ? (u8)a.name[min_size] : a.terminator;
+    const u8 b_next = b.name_size > min_size ? (u8)b.name[min_size] : b.terminator;
+    return a_next < b_next;
+}
+
+void RomFSBuildContext::CollectSortedDirectories(RomFSBuildDirectoryContext *parent, std::vector<RomFSBuildDirectoryContext *> *out) {
+    std::vector<RomFSBuildSortItem> items;
+    for (RomFSBuildDirectoryContext *cur = parent->child; cur != NULL; cur = cur->sibling) {
+        items.push_back({cur->name, cur->name_size, '\x00', cur});
+        if (cur->child != NULL) {
+            items.push_back({cur->name, cur->name_size, '/', cur});
+        }
+    }
+    std::sort(items.begin(), items.end(), RomFSBuildSortItemLess);
+    
+    for (const auto &item : items) {
+        RomFSBuildDirectoryContext *cur = static_cast<RomFSBuildDirectoryContext *>(item.ctx);
+        if (item.terminator == '\x00') {
+            out->push_back(cur);
+        } else {
+            this->CollectSortedDirectories(cur, out);
+        }
+    }
+}
+
+void RomFSBuildContext::CollectSortedFiles(RomFSBuildDirectoryContext *parent, std::vector<RomFSBuildFileContext *> *out) {
+    std::vector<RomFSBuildSortItem> items;
+    for (RomFSBuildFileContext *cur = parent->file; cur != NULL; cur = cur->sibling) {
+        items.push_back({cur->name, cur->name_size, '\x00', cur});
+    }
+    for (RomFSBuildDirectoryContext *cur = parent->child; cur != NULL; cur = cur->sibling) {
+        items.push_back({cur->name, cur->name_size, '/', cur});
+    }
+    std::sort(items.begin(), items.end(), RomFSBuildSortItemLess);
+    
+    for (const auto &item : items) {
+        if (item.terminator == '\x00') {
+            out->push_back(static_cast<RomFSBuildFileContext *>(item.ctx));
+        } else {
+            this->CollectSortedFiles(static_cast<RomFSBuildDirectoryContext *>(item.ctx), out);
+        }
+    }
 }
 
-void RomFSBuildContext::Build(std::vector<RomFSSourceInfo> *out_infos) {
+void RomFSBuildContext::Build(std::vector<RomFSSourceInfo> *out_infos, std::vector<RomFSManifestEntry> *out_manifest) {
     RomFSBuildFileContext *cur_file;
     RomFSBuildDirectoryContext *cur_dir;
     u32 entry_offset;
@@ -263,55 +339,78 @@ void RomFSBuildContext::Build(std::vector<RomFSSourceInfo> *out_infos) {
     
     out_infos->clear();
     out_infos->emplace_back(0, sizeof(*header), header, RomFSDataSource::Memory);
+    
+    /* Determine layout order. */
+    std::vector<RomFSBuildDirectoryContext *> sorted_dirs;
+    std::vector<RomFSBuildFileContext *> sorted_files;
+    sorted_dirs.reserve(this->num_dirs);
+    sorted_files.reserve(this->num_files);
+    sorted_dirs.push_back(this->root);
+    this->CollectSortedDirectories(this->root, &sorted_dirs);
+    this->CollectSortedFiles(this->root, &sorted_files);
+    this->directories.Clear();
+    this->files.Clear();
+    
+    /* Clear the unsorted build-time links, so they can be assigned in layout order. */
+    for (const auto &it : sorted_dirs) {
+        it->child = NULL;
+        it->sibling = NULL;
+        it->file = NULL;
+    }
+    for (const auto &it : sorted_files) {
+        it->sibling = NULL;
+    }
         
     /* Determine file offsets. */
     entry_offset = 0;
     RomFSBuildFileContext *prev_file = NULL;
-    for (const auto &it : this->files) {
-        cur_file = it.second;
-        this->file_partition_size = (this->file_partition_size + 0xFULL) & ~0xFULL;
+    RomFSManifestEntry prev_entry = {0}, cur_entry = {0};
+    if (out_manifest != NULL) {
+        out_manifest->clear();
+        out_manifest->reserve(this->num_files);
+    }
+    for (const auto &it : sorted_files) {
+        cur_file = it;
+        cur_entry.orig_offset = cur_file->orig_offset;
+        cur_entry.source = (u32)cur_file->source;
         /* Check for extra padding in the original romfs source and preserve it, to help ourselves later. */
-        if (prev_file && prev_file->source == cur_file->source && (prev_file->source == RomFSDataSource::BaseRomFS || prev_file->source == RomFSDataSource::FileRomFS)) {
-            u64 expected = (this->file_partition_size - prev_file->offset + prev_file->orig_offset);
-            if (expected != cur_file->orig_offset) {
-                if (expected > cur_file->orig_offset) {
-                    /* This case should NEVER happen. */
-                    fatalSimple(0xF601);
-                }
-                this->file_partition_size += cur_file->orig_offset - expected;
-            }
-        }
+        this->file_partition_size = romfs_get_file_offset(this->file_partition_size, prev_file ? &prev_entry : NULL, prev_file ? prev_file->offset : 0, &cur_entry);
         cur_file->offset = this->file_partition_size;
         this->file_partition_size += cur_file->size;
         cur_file->entry_offset = entry_offset;
-        entry_offset += sizeof(RomFSFileEntry) + ((cur_file->path_len - cur_file->cur_path_ofs + 3) & ~3);
+        entry_offset += sizeof(RomFSFileEntry) + ((cur_file->name_size + 3) & ~3);
         prev_file = cur_file;
+        prev_entry = cur_entry;
+        if (out_manifest != NULL) {
+            out_manifest->push_back(cur_entry);
+        }
     }
     /* Assign deferred parent/sibling ownership. */
-    for (auto it = this->files.rbegin(); it != this->files.rend(); it++) {
-        cur_file = it->second;
+    for (auto it = sorted_files.rbegin(); it != sorted_files.rend(); it++) {
+        cur_file = *it;
         cur_file->sibling = cur_file->parent->file;
         cur_file->parent->file = cur_file;
     }
     
     /* Determine directory offsets. */
     entry_offset = 0;
-    for (const auto &it : this->directories) {
-        cur_dir = it.second;
+    for (const auto &it : sorted_dirs) {
+        cur_dir = it;
         cur_dir->entry_offset = entry_offset;
-        entry_offset += sizeof(RomFSDirectoryEntry) + ((cur_dir->path_len - cur_dir->cur_path_ofs + 3) & ~3);
+        entry_offset += sizeof(RomFSDirectoryEntry) + ((cur_dir->name_size + 3) & ~3);
     }
     /* Assign deferred parent/sibling ownership. */
-    for (auto it = this->directories.rbegin(); it->second != this->root; it++) {
-        cur_dir = it->second;
+    for (auto it = sorted_dirs.rbegin(); *it != this->root; it++) {
+        cur_dir = *it;
         cur_dir->sibling = cur_dir->parent->child;
         cur_dir->parent->child = cur_dir;
     }
     
     
     /* Populate file tables. */
-    for (const auto &it : this->files) {
-        cur_file = it.second;
+    RomFSManifestEntry cur_manifest_entry = {0};
+    for (const auto &it : sorted_files) {
+        cur_file = it;
         RomFSFileEntry *cur_entry = romfs_get_fentry(file_table, cur_file->entry_offset);
 
         cur_entry->parent = cur_file->parent->entry_offset;
@@ -319,72 +418,47 @@ void RomFSBuildContext::Build(std::vector<RomFSSourceInfo> *out_infos) {
         cur_entry->offset = cur_file->offset;
         cur_entry->size = cur_file->size;
         
-        u32 name_size = cur_file->path_len - cur_file->cur_path_ofs;
-        u32 hash = romfs_calc_path_hash(cur_file->parent->entry_offset, (unsigned char *)cur_file->path + cur_file->cur_path_ofs, 0, name_size);
+        u32 name_size = cur_file->name_size;
+        u32 hash = romfs_calc_path_hash(cur_file->parent->entry_offset, (const unsigned char *)cur_file->name, 0, name_size);
         cur_entry->hash = file_hash_table[hash % file_hash_table_entry_count];
         file_hash_table[hash % file_hash_table_entry_count] = cur_file->entry_offset;
            
         cur_entry->name_size = name_size;
         memset(cur_entry->name, 0, (cur_entry->name_size + 3) & ~3);
-        memcpy(cur_entry->name, cur_file->path + cur_file->cur_path_ofs, name_size);
+        memcpy(cur_entry->name, cur_file->name, name_size);
         
-        switch (cur_file->source) {
-            case RomFSDataSource::BaseRomFS:
-            case RomFSDataSource::FileRomFS:
-                /* Try to compact, if possible. */
-                if (out_infos->back().type == cur_file->source) {
-                    out_infos->back().size = cur_file->offset + ROMFS_FILEPARTITION_OFS + cur_file->size - out_infos->back().virtual_offset;
-                } else {
-                    out_infos->emplace_back(cur_file->offset + ROMFS_FILEPARTITION_OFS, cur_file->size, cur_file->orig_offset + ROMFS_FILEPARTITION_OFS, cur_file->source);
-                }
-                break;
-            case RomFSDataSource::LooseFile:
-                {
-                    char *path = new char[cur_file->path_len + 1];
-                    strcpy(path, cur_file->path);
-                    out_infos->emplace_back(cur_file->offset + ROMFS_FILEPARTITION_OFS, cur_file->size, path, cur_file->source);
-                }
-                break;
-            default:
-                fatalSimple(0xF601);
+        char *path = NULL;
+        if (cur_file->source == RomFSDataSource::LooseFile) {
+            path = new char[cur_file->path_len + 1];
+            romfs_build_path(path, cur_file->parent, cur_file->name, cur_file->name_size, cur_file->path_len);
         }
+        cur_manifest_entry.orig_offset = cur_file->orig_offset;
+        cur_manifest_entry.source = (u32)cur_file->source;
+        romfs_add_file_source_info(out_infos, cur_file->offset, cur_file->size, &cur_manifest_entry, path);
     }
         
     /* Populate dir tables. */
-    for (const auto &it : this->directories) {
-        cur_dir = it.second;
+    for (const auto &it : sorted_dirs) {
+        cur_dir = it;
         RomFSDirectoryEntry *cur_entry = romfs_get_direntry(dir_table, cur_dir->entry_offset);
         cur_entry->parent = cur_dir == this->root ? 0 : cur_dir->parent->entry_offset;
         cur_entry->sibling = (cur_dir->sibling == NULL) ? ROMFS_ENTRY_EMPTY : cur_dir->sibling->entry_offset;
         cur_entry->child = (cur_dir->child == NULL) ? ROMFS_ENTRY_EMPTY : cur_dir->child->entry_offset;
         cur_entry->file = (cur_dir->file == NULL) ? ROMFS_ENTRY_EMPTY : cur_dir->file->entry_offset;
         
-        u32 name_size = cur_dir->path_len - cur_dir->cur_path_ofs;
-        u32 hash = romfs_calc_path_hash(cur_dir == this->root ? 0 : cur_dir->parent->entry_offset, (unsigned char *)cur_dir->path + cur_dir->cur_path_ofs, 0, name_size);
+        u32 name_size = cur_dir->name_size;
+        u32 hash = romfs_calc_path_hash(cur_dir == this->root ? 0 : cur_dir->parent->entry_offset, (const unsigned char *)cur_dir->name, 0, name_size);
         cur_entry->hash = dir_hash_table[hash % dir_hash_table_entry_count];
         dir_hash_table[hash % dir_hash_table_entry_count] = cur_dir->entry_offset;
         
         cur_entry->name_size = name_size;
         memset(cur_entry->name, 0, (cur_entry->name_size + 3) & ~3);
-        memcpy(cur_entry->name, cur_dir->path + cur_dir->cur_path_ofs, name_size);
+        memcpy(cur_entry->name, cur_dir->name, name_size);
     }
     
-    /* Delete directories. */
-    for (const auto &it : this->directories) {
-        cur_dir = it.second;
-        delete cur_dir->path;
-        delete cur_dir;
-    }
+    /* Delete directories and files. */
     this->root = NULL;
-    this->directories.clear();
-    
-    /* Delete files. */
-    for (const auto &it : this->files) {
-        cur_file = it.second;
-        delete cur_file->path;
-        delete cur_file;
-    }
-    this->files.clear();
+    this->arena.Reset();
     
     /* Set header fields. */
     header->header_size = sizeof(*header);
@@ -392,11 +466,7 @@ void RomFSBuildContext::Build(std::vector<RomFSSourceInfo> *out_infos) {
     header->file_table_size = this->file_table_size;
     header->dir_hash_table_size = this->dir_hash_table_size;
     header->dir_table_size = this->dir_table_size;
-    header->file_partition_ofs = ROMFS_FILEPARTITION_OFS;
-    header->dir_hash_table_ofs = (header->file_partition_ofs + this->file_partition_size + 3ULL) & ~3ULL;
-    header->dir_table_ofs = header->dir_hash_table_ofs + header->dir_hash_table_size;
-    header->file_hash_table_ofs = header->dir_table_ofs + header->dir_table_size;
-    header->file_table_ofs = header->file_hash_table_ofs + header->file_hash_table_size;
+    romfs_set_header_table_offsets(header, this->file_partition_size);
     
     const size_t metadata_size = this->dir_hash_table_size + this->dir_table_size + this->file_hash_table_size + this->file_table_size;
     
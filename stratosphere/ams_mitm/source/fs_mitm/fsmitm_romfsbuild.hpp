@@ -16,7 +16,8 @@
  
 #pragma once
 #include <switch.h>
-#include <map>
+#include <vector>
+#include <new>
 
 #include "fsmitm_romstorage.hpp"
 
@@ -35,6 +36,7 @@ enum class RomFSDataSource {
     MetaData,
     Memory,
 };
+static constexpr size_t RomFSDataSourceCount = static_cast<size_t>(RomFSDataSource::Memory) + 1;
 
 struct RomFSBaseSourceInfo {
     u64 offset;
@@ -135,6 +137,15 @@ struct RomFSSourceInfo {
     }
 };
 
+/* Where the data of each file in a built RomFS came from, in file table order. */
+struct RomFSManifestEntry {
+    u64 orig_offset;
+    u32 source;
+    u32 reserved;
+};
+
+static_assert(sizeof(RomFSManifestEntry) == 0x10, "Incorrect RomFSManifestEntry definition!");
+
 /* Types for building a RomFS. */
 struct RomFSHeader {
     u64 header_size;
@@ -177,43 +188,162 @@ static_assert(sizeof(RomFSFileEntry) == 0x20, "Incorrect RomFSFileEntry definiti
 
 struct RomFSBuildFileContext;
 
-/* Used as comparator for std::map<char *, RomFSBuild*Context> */
-struct build_ctx_cmp {
-    bool operator()(const char *a, const char *b) const {
-        return strcmp(a, b) < 0;
-    }
-};
-
 struct RomFSBuildDirectoryContext {
-    char *path;
-    u32 cur_path_ofs;
-    u32 path_len;
+    /* Name within the parent directory, not NUL-terminated. */
+    const char *name = NULL;
+    u32 name_size = 0;
+    u32 path_len = 0;
     u32 entry_offset = 0;
+    u32 index_hash = 0;
     RomFSBuildDirectoryContext *parent = NULL;
     RomFSBuildDirectoryContext *child = NULL;
     RomFSBuildDirectoryContext *sibling = NULL;
     RomFSBuildFileContext *file = NULL;
+    RomFSBuildDirectoryContext *index_next = NULL;
 };
 
 struct RomFSBuildFileContext {
-    char *path;
-    u32 cur_path_ofs;
-    u32 path_len;
+    /* Name within the parent directory, not NUL-terminated. */
+    const char *name = NULL;
+    u32 name_size = 0;
+    u32 path_len = 0;
     u32 entry_offset = 0;
+    u32 index_hash = 0;
     u64 offset = 0;
     u64 size = 0;
     RomFSBuildDirectoryContext *parent = NULL;
     RomFSBuildFileContext *sibling = NULL;
+    RomFSBuildFileContext *index_next = NULL;
     RomFSDataSource source{0};
     u64 orig_offset = 0;
 };
 
+/* Bump allocator for build contexts and names. Everything is freed at once. */
+class RomFSBuildArena {
+    private:
+        static constexpr size_t BlockSize = 0x10000;
+    private:
+        std::vector<u8 *> blocks;
+        u8 *cur_block = NULL;
+        size_t cur_offset = 0;
+        size_t cur_size = 0;
+    public:
+        RomFSBuildArena() { }
+        ~RomFSBuildArena() {
+            this->Reset();
+        }
+        
+        void *Allocate(size_t size, size_t align) {
+            size_t ofs = (this->cur_offset + align - 1) & ~(align - 1);
+            if (this->cur_block == NULL || ofs + size > this->cur_size) {
+                this->cur_size = size > BlockSize ? size : BlockSize;
+                this->cur_block = new u8[this->cur_size];
+                this->blocks.push_back(this->cur_block);
+                ofs = 0;
+            }
+            this->cur_offset = ofs + size;
+            return this->cur_block + ofs;
+        }
+        
+        template<typename T>
+        T *New() {
+            return new (this->Allocate(sizeof(T), alignof(T))) T();
+        }
+        
+        const char *CopyName(const char *name, size_t name_size) {
+            char *out = static_cast<char *>(this->Allocate(name_size, 1));
+            memcpy(out, name, name_size);
+            return out;
+        }
+        
+        void Reset() {
+            for (auto block : this->blocks) {
+                delete[] block;
+            }
+            this->blocks.clear();
+            this->blocks.shrink_to_fit();
+            this->cur_block = NULL;
+            this->cur_offset = 0;
+            this->cur_size = 0;
+        }
+};
+
+/* Intrusive hash index of build contexts, keyed by (parent, name). */
+template<typename T>
+class RomFSBuildIndex {
+    private:
+        std::vector<T *> buckets;
+        size_t count = 0;
+    private:
+        void Grow() {
+            std::vector<T *> old_buckets(std::move(this->buckets));
+            this->buckets.assign(old_buckets.empty() ? 0x100 : old_buckets.size() * 2, NULL);
+            for (T *head : old_buckets) {
+                while (head != NULL) {
+                    T *next = head->index_next;
+                    T **bucket = &this->buckets[head->index_hash & (this->buckets.size() - 1)];
+                    head->index_next = *bucket;
+                    *bucket = head;
+                    head = next;
+                }
+            }
+        }
+    public:
+        static u32 Hash(const RomFSBuildDirectoryContext *parent, const char *name, u32 name_size) {
+            u32 hash = (u32)((uintptr_t)parent >> 3);
+            for (u32 i = 0; i < name_size; i++) {
+                hash = hash * 31 + (u8)name[i];
+            }
+            return hash;
+        }
+        
+        T *Find(const RomFSBuildDirectoryContext *parent, const char *name, u32 name_size, u32 hash) const {
+            if (this->buckets.empty()) {
+                return NULL;
+            }
+            for (T *cur = this->buckets[hash & (this->buckets.size() - 1)]; cur != NULL; cur = cur->index_next) {
+                if (cur->index_hash == hash && cur->parent == parent && cur->name_size == name_size && memcmp(cur->name, name, name_size) == 0) {
+                    return cur;
+                }
+            }
+            return NULL;
+        }
+        
+        void Insert(T *ctx) {
+            if (this->count >= this->buckets.size()) {
+                this->Grow();
+            }
+            T **bucket = &this->buckets[ctx->index_hash & (this->buckets.size() - 1)];
+            ctx->index_next = *bucket;
+            *bucket = ctx;
+            this->count++;
+        }
+        
+        void Clear() {
+            this->buckets.clear();
+            this->buckets.shrink_to_fit();
+            this->count = 0;
+        }
+};
+
+/* The directory and file tables of a RomFS storage, read ahead of merging them. */
+struct RomFSStorageTables {
+    std::unique_ptr<u8[]> dir_table;
+    std::unique_ptr<u8[]> file_table;
+    size_t dir_table_size = 0;
+    size_t file_table_size = 0;
+    bool is_valid = false;
+};
+
 class RomFSBuildContext {
+    private:
+        static constexpr size_t DirectoryEntryBatchCount = 0x40;
     private:
         u64 title_id;
+        RomFSBuildArena arena;
         RomFSBuildDirectoryContext *root;
-        std::map<char *, RomFSBuildDirectoryContext *, build_ctx_cmp> directories;
-        std::map<char *, RomFSBuildFileContext *, build_ctx_cmp> files;
+        RomFSBuildIndex<RomFSBuildDirectoryContext> directories;
+        RomFSBuildIndex<RomFSBuildFileContext> files;
         u64 num_dirs = 0;
         u64 num_files = 0;
         u64 dir_table_size = 0;
@@ -222,31 +352,94 @@ class RomFSBuildContext {
         u64 file_hash_table_size = 0;
         u64 file_partition_size = 0;
         
-        FsDirectoryEntry dir_entry;
+        char path_buf[FS_MAX_PATH];
         RomFSDataSource cur_source_type;
+        /* Entries we may still visit while merging a RomFS storage. */
+        u64 num_table_entries_left = 0;
         
         void VisitDirectory(FsFileSystem *filesys, RomFSBuildDirectoryContext *parent);
         void VisitDirectory(RomFSBuildDirectoryContext *parent, u32 parent_offset, void *dir_table, size_t dir_table_size, void *file_table, size_t file_table_size);
     
-        bool AddDirectory(RomFSBuildDirectoryContext *parent_dir_ctx, RomFSBuildDirectoryContext *dir_ctx, RomFSBuildDirectoryContext **out_dir_ctx);
-        bool AddFile(RomFSBuildDirectoryContext *parent_dir_ctx, RomFSBuildFileContext *file_ctx);
+        RomFSBuildDirectoryContext *AddDirectory(RomFSBuildDirectoryContext *parent_dir_ctx, const char *name, u32 name_size);
+        void AddFile(RomFSBuildDirectoryContext *parent_dir_ctx, const char *name, u32 name_size, u64 size, u64 orig_offset);
+        
+        void CollectSortedDirectories(RomFSBuildDirectoryContext *parent, std::vector<RomFSBuildDirectoryContext *> *out);
+        void CollectSortedFiles(RomFSBuildDirectoryContext *parent, std::vector<RomFSBuildFileContext *> *out);
     public:
         RomFSBuildContext(u64 tid) : title_id(tid) {
-            this->root = new RomFSBuildDirectoryContext({0});
-            this->root->path = new char[1];
-            this->root->path[0] = '\x00';
-            this->directories.insert({this->root->path, this->root});
+            this->root = this->arena.New<RomFSBuildDirectoryContext>();
             this->num_dirs = 1;
             this->dir_table_size = 0x18;
         }
         
         void MergeSdFiles();
         void MergeRomStorage(IROStorage *storage, RomFSDataSource source);
+        /* Reading tables touches nothing in the context, so it may happen on another thread while merging. */
+        static void ReadRomStorageTables(IROStorage *storage, RomFSStorageTables *out);
+        void MergeRomStorageTables(RomFSStorageTables *tables, RomFSDataSource source);
         
-        /* This finalizes the context. */
-        void Build(std::vector<RomFSSourceInfo> *out_infos);
+        /* This finalizes the context. If out_manifest is set, it receives the source of every file. */
+        void Build(std::vector<RomFSSourceInfo> *out_infos, std::vector<RomFSManifestEntry> *out_manifest = nullptr);
 };
 
+/* Writes the full path of the entry named name in parent to out, which must hold path_len + 1 bytes. */
+static inline void romfs_build_path(char *out, const RomFSBuildDirectoryContext *parent, const char *name, u32 name_size, u32 path_len) {
+    u32 ofs = path_len - name_size;
+    out[path_len] = '\x00';
+    memcpy(out + ofs, name, name_size);
+    while (parent != NULL && ofs > 0) {
+        out[--ofs] = '/';
+        ofs -= parent->name_size;
+        memcpy(out + ofs, parent->name, parent->name_size);
+        parent = parent->parent;
+    }
+}
+
+/* Returns where a file goes in a file partition of the given size. Padding between files from the same RomFS is preserved. */
+static inline u64 romfs_get_file_offset(u64 file_partition_size, const RomFSManifestEntry *prev, u64 prev_offset, const RomFSManifestEntry *cur) {
+    file_partition_size = (file_partition_size + 0xFULL) & ~0xFULL;
+    if (prev != NULL && prev->source == cur->source && (prev->source == (u32)RomFSDataSource::BaseRomFS || prev->source == (u32)RomFSDataSource::FileRomFS)) {
+        u64 expected = (file_partition_size - prev_offset + prev->orig_offset);
+        if (expected != cur->orig_offset) {
+            if (expected > cur->orig_offset) {
+                /* This case should NEVER happen. */
+                fatalSimple(0xF601);
+            }
+            file_partition_size += cur->orig_offset - expected;
+        }
+    }
+    return file_partition_size;
+}
+
+/* Adds the source info for a file placed at offset in the file partition. Path is owned by the source info, for loose files. */
+static inline void romfs_add_file_source_info(std::vector<RomFSSourceInfo> *out_infos, u64 offset, u64 size, const RomFSManifestEntry *entry, char *path) {
+    const RomFSDataSource source = (RomFSDataSource)entry->source;
+    switch (source) {
+        case RomFSDataSource::BaseRomFS:
+        case RomFSDataSource::FileRomFS:
+            /* Try to compact, if possible. */
+            if (out_infos->back().type == source) {
+                out_infos->back().size = offset + ROMFS_FILEPARTITION_OFS + size - out_infos->back().virtual_offset;
+            } else {
+                out_infos->emplace_back(offset + ROMFS_FILEPARTITION_OFS, size, entry->orig_offset + ROMFS_FILEPARTITION_OFS, source);
+            }
+            break;
+        case RomFSDataSource::LooseFile:
+            out_infos->emplace_back(offset + ROMFS_FILEPARTITION_OFS, size, path, source);
+            break;
+        default:
+            fatalSimple(0xF601);
+    }
+}
+
+/* Sets the offsets of the metadata tables, which follow the file partition. */
+static inline void romfs_set_header_table_offsets(RomFSHeader *header, u64 file_partition_size) {
+    header->file_partition_ofs = ROMFS_FILEPARTITION_OFS;
+    header->dir_hash_table_ofs = (header->file_partition_ofs + file_partition_size + 3ULL) & ~3ULL;
+    header->dir_table_ofs = header->dir_hash_table_ofs + header->dir_hash_table_size;
+    header->file_hash_table_ofs = header->dir_table_ofs + header->dir_table_size;
+    header->file_table_ofs = header->file_hash_table_ofs + header->file_hash_table_size;
+}
 
 static inline RomFSDirectoryEntry *romfs_get_direntry(void *directories, uint32_t offset) {
     return (RomFSDirectoryEntry *)((uintptr_t)directories + offset);
@@ -256,11 +449,25 @@ static inline RomFSFileEntry *romfs_get_fentry(void *files, uint32_t offset) {
     return (RomFSFileEntry *)((uintptr_t)files + offset);
 }
 
+static inline uint32_t romfs_rotr32(uint32_t x, uint32_t n) {
+    return (x >> n) | (x << ((32 - n) & 31));
+}
+
 static inline uint32_t romfs_calc_path_hash(uint32_t parent, const unsigned char *path, uint32_t start, size_t path_len) {
     uint32_t hash = parent ^ 123456789;
-    for (uint32_t i = 0; i < path_len; i++) {
+    path += start;
+    
+    /* Rotation distributes over xor, so eight steps of the loop below are one rotation of the hash (by 40, i.e. 8) */
+    /* xored with each byte rotated by 5 for every later step, modulo 32. The byte terms don't depend on each other. */
+    size_t i = 0;
+    for (; i + 8 <= path_len; i += 8) {
+        const uint32_t mixed = romfs_rotr32(path[i + 0], 3) ^ romfs_rotr32(path[i + 1], 30) ^ romfs_rotr32(path[i + 2], 25) ^ romfs_rotr32(path[i + 3], 20)
+                             ^ romfs_rotr32(path[i + 4], 15) ^ romfs_rotr32(path[i + 5], 10) ^ romfs_rotr32(path[i + 6], 5) ^ path[i + 7];
+        hash = romfs_rotr32(hash, 8) ^ mixed;
+    }
+    for (; i < path_len; i++) {
         hash = (hash >> 5) | (hash << 27);
-        hash ^= path[start + i];
+        hash ^= path[i];
     }
         
     return hash;
@@ -0,0 +1,537 @@
+/*
+ * Copyright (c) 2018 Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <switch.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include <stratosphere.hpp>
+#include "../utils.hpp"
+#include "../sha256.h"
+#include "fsmitm_romfsindex.hpp"
+
+#include "../debug.hpp"
+
+static constexpr size_t RomFSIndexHashChunkSize = 0x10000;
+static constexpr size_t RomFSIndexDirectoryEntryBatchCount = 0x40;
+
+static void FingerprintSdDirectory(u64 title_id, struct sha256_state *sha_ctx, struct sha256_state *size_sha_ctx, RomFSSdFileSizes *out_sizes) {
+    FsDir dir;
+    u64 read_entries;
+    
+    /* Walk the tree with an explicit stack, reading entries in batches into a single buffer. */
+    std::vector<std::string> dir_stack;
+    auto dir_entries = std::make_unique<FsDirectoryEntry[]>(RomFSIndexDirectoryEntryBatchCount);
+    dir_stack.emplace_back("");
+
+    while (!dir_stack.empty()) {
+        const std::string path = std::move(dir_stack.back());
+        dir_stack.pop_back();
+
+        sha256_update(sha_ctx, path.c_str(), path.length() + 1);
+        if (R_FAILED(Utils::OpenRomFSSdDir(title_id, path.c_str(), &dir))) {
+            /* The full build will fail on this directory anyway; make sure we never match. */
+            const u64 invalid = UINT64_MAX;
+            sha256_update(sha_ctx, &invalid, sizeof(invalid));
+            continue;
+        }
+
+        u64 num_entries = 0;
+        while (R_SUCCEEDED(fsDirRead(&dir, 0, &read_entries, RomFSIndexDirectoryEntryBatchCount, dir_entries.get())) && read_entries > 0) {
+            for (u64 i = 0; i < read_entries; i++) {
+                const FsDirectoryEntry *cur_entry = &dir_entries[i];
+                const size_t name_size = strlen(cur_entry->name);
+                const u8 type = cur_entry->type;
+                sha256_update(sha_ctx, &type, sizeof(type));
+                sha256_update(sha_ctx, cur_entry->name, name_size + 1);
+                if (cur_entry->type == ENTRYTYPE_DIR) {
+                    if (path.length() + 1 + name_size > FS_MAX_PATH - 1) {
+                        const u64 invalid = UINT64_MAX;
+                        sha256_update(sha_ctx, &invalid, sizeof(invalid));
+                    } else {
+                        dir_stack.push_back(path + "/" + cur_entry->name);
+                    }
+                } else {
+                    sha256_update(size_sha_ctx, &cur_entry->fileSize, sizeof(cur_entry->fileSize));
+                    if (out_sizes != nullptr) {
+                        (*out_sizes)[path + "/" + cur_entry->name] = cur_entry->fileSize;
+                    }
+                }
+                num_entries++;
+            }
+        }
+        fsDirClose(&dir);
+
+        sha256_update(sha_ctx, &num_entries, sizeof(num_entries));
+    }
+}
+
+static void FingerprintRomStorageRange(IROStorage *storage, u64 offset, u64 size, u8 *buffer, struct sha256_state *sha_ctx) {
+    while (size > 0) {
+        const size_t cur_size = size < RomFSIndexHashChunkSize ? size : RomFSIndexHashChunkSize;
+        if (R_FAILED(storage->Read(buffer, cur_size, offset))) {
+            const u64 invalid = UINT64_MAX;
+            sha256_update(sha_ctx, &invalid, sizeof(invalid));
+            return;
+        }
+        sha256_update(sha_ctx, buffer, cur_size);
+        offset += cur_size;
+        size -= cur_size;
+    }
+}
+
+static void FingerprintRomStorage(IROStorage *storage, struct sha256_state *sha_ctx) {
+    RomFSHeader header = {0};
+    u8 is_present = storage != nullptr && R_SUCCEEDED(storage->Read(&header, sizeof(header), 0));
+    sha256_update(sha_ctx, &is_present, sizeof(is_present));
+    if (!is_present) {
+        return;
+    }
+
+    sha256_update(sha_ctx, &header, sizeof(header));
+    if (header.header_size != sizeof(header)) {
+        return;
+    }
+
+    /* The directory and file tables determine names, offsets and sizes of everything we merge. */
+    auto buffer = std::make_unique<u8[]>(RomFSIndexHashChunkSize);
+    FingerprintRomStorageRange(storage, header.dir_table_ofs, header.dir_table_size, buffer.get(), sha_ctx);
+    FingerprintRomStorageRange(storage, header.file_table_ofs, header.file_table_size, buffer.get(), sha_ctx);
+}
+
+void RomFSIndex::CalculateFingerprint(u64 title_id, IROStorage *file_romfs, IROStorage *storage_romfs, u8 *out_fingerprint, u8 *out_structure_fingerprint, RomFSSdFileSizes *out_sizes) {
+    struct sha256_state sha_ctx, size_sha_ctx;
+    sha256_init(&sha_ctx);
+    sha256_init(&size_sha_ctx);
+
+    const u32 version = ROMFS_INDEX_VERSION;
+    sha256_update(&sha_ctx, &version, sizeof(version));
+
+    /* Hash the SD romfs tree, mirroring RomFSBuildContext::MergeSdFiles. */
+    FsDir dir;
+    u8 has_sd_files = Utils::IsSdInitialized() && R_SUCCEEDED(Utils::OpenSdDirForAtmosphere(title_id, "/romfs", &dir));
+    sha256_update(&sha_ctx, &has_sd_files, sizeof(has_sd_files));
+    if (has_sd_files) {
+        fsDirClose(&dir);
+        FingerprintSdDirectory(title_id, &sha_ctx, &size_sha_ctx, out_sizes);
+    }
+
+    FingerprintRomStorage(file_romfs, &sha_ctx);
+    FingerprintRomStorage(storage_romfs, &sha_ctx);
+
+    sha256_finalize(&sha_ctx);
+    sha256_finish(&sha_ctx, out_structure_fingerprint);
+
+    /* The full fingerprint also depends on the sizes of SD files. */
+    u8 size_digest[ROMFS_INDEX_FINGERPRINT_SIZE];
+    sha256_finalize(&size_sha_ctx);
+    sha256_finish(&size_sha_ctx, size_digest);
+
+    sha256_init(&sha_ctx);
+    sha256_update(&sha_ctx, out_structure_fingerprint, ROMFS_INDEX_FINGERPRINT_SIZE);
+    sha256_update(&sha_ctx, size_digest, sizeof(size_digest));
+    sha256_finalize(&sha_ctx);
+    sha256_finish(&sha_ctx, out_fingerprint);
+}
+
+/* A validated index, as read from the SD card. */
+struct RomFSIndexData {
+    RomFSIndexHeader header;
+    std::unique_ptr<u8[]> body;
+    const RomFSIndexSourceInfo *source_table;
+    const char *string_table;
+    const u8 *memory_data;
+    const RomFSManifestEntry *manifest;
+};
+
+static bool ReadIndex(u64 title_id, RomFSIndexData *out) {
+    FsFile f;
+    if (R_FAILED(Utils::OpenSdFileForAtmosphere(title_id, ROMFS_INDEX_FILE_PATH, FS_OPEN_READ, &f))) {
+        return false;
+    }
+    ON_SCOPE_EXIT {
+        fsFileClose(&f);
+    };
+
+    /* Validate header. */
+    u64 file_size;
+    size_t read_size;
+    RomFSIndexHeader &header = out->header;
+    if (R_FAILED(fsFileGetSize(&f, &file_size)) || file_size < sizeof(header)) {
+        return false;
+    }
+    if (R_FAILED(fsFileRead(&f, 0, &header, sizeof(header), &read_size)) || read_size != sizeof(header)) {
+        return false;
+    }
+    if (header.magic != ROMFS_INDEX_MAGIC || header.version != ROMFS_INDEX_VERSION) {
+        return false;
+    }
+
+    const u64 source_table_size = (u64)header.num_source_infos * sizeof(RomFSIndexSourceInfo);
+    const u64 manifest_size = (u64)header.num_manifest_entries * sizeof(RomFSManifestEntry);
+    const u64 body_size = file_size - sizeof(header);
+    if (header.num_source_infos == 0 || header.memory_data_size > body_size || source_table_size + header.string_table_size + header.memory_data_size + manifest_size != body_size) {
+        return false;
+    }
+
+    /* Read and validate body. */
+    out->body = std::make_unique<u8[]>(body_size);
+    u8 *body = out->body.get();
+    if (R_FAILED(fsFileRead(&f, sizeof(header), body, body_size, &read_size)) || read_size != body_size) {
+        return false;
+    }
+    {
+        struct sha256_state sha_ctx;
+        u8 body_hash[ROMFS_INDEX_FINGERPRINT_SIZE];
+        sha256_init(&sha_ctx);
+        sha256_update(&sha_ctx, body, body_size);
+        sha256_finalize(&sha_ctx);
+        sha256_finish(&sha_ctx, body_hash);
+        if (memcmp(header.body_hash, body_hash, sizeof(body_hash)) != 0) {
+            return false;
+        }
+    }
+
+    /* The metadata the index refers to must still be on the SD card. */
+    {
+        FsFile metadata_file;
+        u64 metadata_size;
+        if (R_FAILED(Utils::OpenSdFileForAtmosphere(title_id, ROMFS_METADATA_FILE_PATH, FS_OPEN_READ, &metadata_file))) {
+            return false;
+        }
+        Result rc = fsFileGetSize(&metadata_file, &metadata_size);
+        fsFileClose(&metadata_file);
+        if (R_FAILED(rc) || metadata_size != header.metadata_size) {
+            return false;
+        }
+    }
+
+    out->source_table = reinterpret_cast<const RomFSIndexSourceInfo *>(body);
+    out->string_table = reinterpret_cast<const char *>(body + source_table_size);
+    out->memory_data = body + source_table_size + header.string_table_size;
+    out->manifest = reinterpret_cast<const RomFSManifestEntry *>(body + source_table_size + header.string_table_size + header.memory_data_size);
+    const RomFSIndexSourceInfo *source_table = out->source_table;
+    const char *string_table = out->string_table;
+
+    /* Validate the source infos before we allocate anything for them. */
+    u64 prev_end = 0;
+    for (u32 i = 0; i < header.num_source_infos; i++) {
+        const RomFSIndexSourceInfo *cur = &source_table[i];
+        if (cur->virtual_offset < prev_end || cur->virtual_offset + cur->size < cur->virtual_offset) {
+            return false;
+        }
+        prev_end = cur->virtual_offset + cur->size;
+        switch ((RomFSDataSource)cur->type) {
+            case RomFSDataSource::BaseRomFS:
+            case RomFSDataSource::FileRomFS:
+                break;
+            case RomFSDataSource::LooseFile:
+                if (cur->arg >= header.string_table_size || memchr(string_table + cur->arg, 0, header.string_table_size - cur->arg) == NULL) {
+                    return false;
+                }
+                break;
+            case RomFSDataSource::Memory:
+                if (cur->arg > header.memory_data_size || cur->size > header.memory_data_size - cur->arg) {
+                    return false;
+                }
+                break;
+            case RomFSDataSource::MetaData:
+                if (i != header.num_source_infos - 1 || cur->size != header.metadata_size) {
+                    return false;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+    if ((RomFSDataSource)source_table[header.num_source_infos - 1].type != RomFSDataSource::MetaData) {
+        return false;
+    }
+
+    return true;
+}
+
+static char *CopyPath(const char *src_path) {
+    char *path = new char[strlen(src_path) + 1];
+    strcpy(path, src_path);
+    return path;
+}
+
+static void CleanupSourceInfos(std::vector<RomFSSourceInfo> *infos) {
+    for (auto &info : *infos) {
+        info.Cleanup();
+    }
+    infos->clear();
+}
+
+bool RomFSIndex::Load(u64 title_id, const u8 *fingerprint, std::vector<RomFSSourceInfo> *out_infos) {
+    RomFSIndexData index;
+    if (!ReadIndex(title_id, &index)) {
+        return false;
+    }
+    if (memcmp(index.header.fingerprint, fingerprint, ROMFS_INDEX_FINGERPRINT_SIZE) != 0) {
+        return false;
+    }
+
+    /* Populate output. */
+    out_infos->clear();
+    out_infos->reserve(index.header.num_source_infos);
+    for (u32 i = 0; i < index.header.num_source_infos; i++) {
+        const RomFSIndexSourceInfo *cur = &index.source_table[i];
+        const RomFSDataSource type = (RomFSDataSource)cur->type;
+        switch (type) {
+            case RomFSDataSource::BaseRomFS:
+            case RomFSDataSource::FileRomFS:
+                out_infos->emplace_back(cur->virtual_offset, cur->size, cur->arg, type);
+                break;
+            case RomFSDataSource::LooseFile:
+                out_infos->emplace_back(cur->virtual_offset, cur->size, CopyPath(index.string_table + cur->arg), type);
+                break;
+            case RomFSDataSource::Memory:
+                {
+                    u8 *data = new u8[cur->size];
+                    memcpy(data, index.memory_data + cur->arg, cur->size);
+                    out_infos->emplace_back(cur->virtual_offset, cur->size, data, type);
+                }
+                break;
+            case RomFSDataSource::MetaData:
+                out_infos->emplace_back(cur->virtual_offset, cur->size, type);
+                break;
+            default:
+                fatalSimple(0xF601);
+        }
+    }
+
+    return true;
+}
+
+bool RomFSIndex::Update(u64 title_id, const u8 *fingerprint, const u8 *structure_fingerprint, const RomFSSdFileSizes *sizes, std::vector<RomFSSourceInfo> *out_infos) {
+    RomFSIndexData index;
+    if (!ReadIndex(title_id, &index)) {
+        return false;
+    }
+    if (memcmp(index.header.structure_fingerprint, structure_fingerprint, ROMFS_INDEX_FINGERPRINT_SIZE) != 0) {
+        return false;
+    }
+
+    /* Everything but file offsets and sizes is unchanged, including the header's table sizes. */
+    const RomFSIndexSourceInfo *header_info = &index.source_table[0];
+    if ((RomFSDataSource)header_info->type != RomFSDataSource::Memory || header_info->virtual_offset != 0 || header_info->size != sizeof(RomFSHeader)) {
+        return false;
+    }
+    RomFSHeader *header = new RomFSHeader;
+    memcpy(header, index.memory_data + header_info->arg, sizeof(*header));
+
+    std::vector<RomFSSourceInfo> infos;
+    infos.emplace_back(0, sizeof(*header), header, RomFSDataSource::Memory);
+    bool success = false;
+    ON_SCOPE_EXIT {
+        if (!success) {
+            CleanupSourceInfos(&infos);
+        }
+    };
+
+    /* The file table is the last of the metadata tables. */
+    const u64 file_table_ofs = header->dir_hash_table_size + header->dir_table_size + header->file_hash_table_size;
+    if (file_table_ofs > index.header.metadata_size || header->file_table_size != index.header.metadata_size - file_table_ofs) {
+        return false;
+    }
+    FsFile metadata_file;
+    if (R_FAILED(Utils::OpenSdFileForAtmosphere(title_id, ROMFS_METADATA_FILE_PATH, FS_OPEN_READ | FS_OPEN_WRITE, &metadata_file))) {
+        return false;
+    }
+    ON_SCOPE_EXIT {
+        fsFileClose(&metadata_file);
+    };
+    size_t read_size;
+    auto file_table = std::make_unique<u8[]>(header->file_table_size);
+    if (R_FAILED(fsFileRead(&metadata_file, file_table_ofs, file_table.get(), header->file_table_size, &read_size)) || read_size != header->file_table_size) {
+        return false;
+    }
+
+    /* Lay files out again in file table order, as RomFSBuildContext::Build does, with loose files at their new sizes. */
+    u64 file_partition_size = 0;
+    u64 prev_offset = 0;
+    u32 entry_offset = 0;
+    u32 source_ind = 0;
+    u64 dirty_start = header->file_table_size, dirty_end = 0;
+    for (u32 i = 0; i < index.header.num_manifest_entries; i++) {
+        const RomFSManifestEntry *cur_manifest_entry = &index.manifest[i];
+        if (header->file_table_size < sizeof(RomFSFileEntry) || entry_offset > header->file_table_size - sizeof(RomFSFileEntry)) {
+            return false;
+        }
+        RomFSFileEntry *cur_entry = romfs_get_fentry(file_table.get(), entry_offset);
+        const u32 entry_size = sizeof(RomFSFileEntry) + ((cur_entry->name_size + 3) & ~3);
+        if (cur_entry->name_size > header->file_table_size - sizeof(RomFSFileEntry) - entry_offset) {
+            return false;
+        }
+
+        u64 size = cur_entry->size;
+        char *path = NULL;
+        if (cur_manifest_entry->source == (u32)RomFSDataSource::LooseFile) {
+            /* Loose files each have their own source info, in the same order. */
+            while (source_ind < index.header.num_source_infos && (RomFSDataSource)index.source_table[source_ind].type != RomFSDataSource::LooseFile) {
+                source_ind++;
+            }
+            if (source_ind == index.header.num_source_infos) {
+                return false;
+            }
+            const char *src_path = index.string_table + index.source_table[source_ind++].arg;
+            auto it = sizes->find(src_path);
+            if (it == sizes->end()) {
+                return false;
+            }
+            size = it->second;
+            path = CopyPath(src_path);
+        } else if (cur_manifest_entry->source != (u32)RomFSDataSource::BaseRomFS && cur_manifest_entry->source != (u32)RomFSDataSource::FileRomFS) {
+            return false;
+        }
+
+        const u64 offset = romfs_get_file_offset(file_partition_size, i > 0 ? &index.manifest[i - 1] : NULL, prev_offset, cur_manifest_entry);
+        if (cur_entry->offset != offset || cur_entry->size != size) {
+            cur_entry->offset = offset;
+            cur_entry->size = size;
+            dirty_start = std::min<u64>(dirty_start, entry_offset);
+            dirty_end = std::max<u64>(dirty_end, entry_offset + sizeof(RomFSFileEntry));
+        }
+        romfs_add_file_source_info(&infos, offset, size, cur_manifest_entry, path);
+
+        file_partition_size = offset + size;
+        prev_offset = offset;
+        entry_offset += entry_size;
+    }
+    if (entry_offset != header->file_table_size) {
+        return false;
+    }
+    for (; source_ind < index.header.num_source_infos; source_ind++) {
+        if ((RomFSDataSource)index.source_table[source_ind].type == RomFSDataSource::LooseFile) {
+            return false;
+        }
+    }
+
+    romfs_set_header_table_offsets(header, file_partition_size);
+    infos.emplace_back(header->dir_hash_table_ofs, index.header.metadata_size, RomFSDataSource::MetaData);
+
+    /* Never leave an index describing metadata we're partway through rewriting. */
+    RomFSIndex::Invalidate(title_id);
+    if (dirty_end > dirty_start) {
+        if (R_FAILED(fsFileWrite(&metadata_file, file_table_ofs + dirty_start, file_table.get() + dirty_start, dirty_end - dirty_start))) {
+            return false;
+        }
+    }
+
+    std::vector<RomFSManifestEntry> manifest(index.manifest, index.manifest + index.header.num_manifest_entries);
+    RomFSIndex::Save(title_id, fingerprint, structure_fingerprint, &infos, &manifest);
+
+    CleanupSourceInfos(out_infos);
+    out_infos->swap(infos);
+    success = true;
+    return true;
+}
+
+void RomFSIndex::Save(u64 title_id, const u8 *fingerprint, const u8 *structure_fingerprint, const std::vector<RomFSSourceInfo> *infos, const std::vector<RomFSManifestEntry> *manifest) {
+    /* Only layouts whose metadata lives on the SD card are worth indexing. */
+    if (infos->empty() || infos->back().type != RomFSDataSource::MetaData) {
+        return;
+    }
+
+    RomFSIndexHeader header = {0};
+    header.magic = ROMFS_INDEX_MAGIC;
+    header.version = ROMFS_INDEX_VERSION;
+    memcpy(header.fingerprint, fingerprint, ROMFS_INDEX_FINGERPRINT_SIZE);
+    memcpy(header.structure_fingerprint, structure_fingerprint, ROMFS_INDEX_FINGERPRINT_SIZE);
+    header.metadata_size = infos->back().size;
+    header.num_source_infos = infos->size();
+    header.num_manifest_entries = manifest->size();
+
+    /* Determine table sizes. */
+    u64 string_table_size = 0;
+    for (const auto &info : *infos) {
+        if (info.type == RomFSDataSource::LooseFile) {
+            string_table_size += strlen(info.loose_source_info.path) + 1;
+        } else if (info.type == RomFSDataSource::Memory) {
+            header.memory_data_size += info.size;
+        }
+    }
+    if (string_table_size > UINT32_MAX) {
+        return;
+    }
+    header.string_table_size = string_table_size;
+
+    const u64 source_table_size = (u64)header.num_source_infos * sizeof(RomFSIndexSourceInfo);
+    const u64 manifest_size = (u64)header.num_manifest_entries * sizeof(RomFSManifestEntry);
+    const u64 body_size = source_table_size + header.string_table_size + header.memory_data_size + manifest_size;
+    auto index = std::make_unique<u8[]>(sizeof(header) + body_size);
+    u8 *body = index.get() + sizeof(header);
+
+    RomFSIndexSourceInfo *source_table = reinterpret_cast<RomFSIndexSourceInfo *>(body);
+    char *string_table = reinterpret_cast<char *>(body + source_table_size);
+    u8 *memory_data = body + source_table_size + header.string_table_size;
+    memcpy(memory_data + header.memory_data_size, manifest->data(), manifest_size);
+
+    /* Serialize source infos. */
+    u64 string_ofs = 0, memory_ofs = 0;
+    for (u32 i = 0; i < header.num_source_infos; i++) {
+        const RomFSSourceInfo *cur = &(*infos)[i];
+        RomFSIndexSourceInfo *out = &source_table[i];
+        out->virtual_offset = cur->virtual_offset;
+        out->size = cur->size;
+        out->type = (u32)cur->type;
+        out->reserved = 0;
+        switch (cur->type) {
+            case RomFSDataSource::BaseRomFS:
+                out->arg = cur->base_source_info.offset;
+                break;
+            case RomFSDataSource::FileRomFS:
+                out->arg = cur->file_source_info.offset;
+                break;
+            case RomFSDataSource::LooseFile:
+                {
+                    const size_t path_size = strlen(cur->loose_source_info.path) + 1;
+                    memcpy(string_table + string_ofs, cur->loose_source_info.path, path_size);
+                    out->arg = string_ofs;
+                    string_ofs += path_size;
+                }
+                break;
+            case RomFSDataSource::Memory:
+                memcpy(memory_data + memory_ofs, cur->memory_source_info.data, cur->size);
+                out->arg = memory_ofs;
+                memory_ofs += cur->size;
+                break;
+            case RomFSDataSource::MetaData:
+                out->arg = 0;
+                break;
+            default:
+                fatalSimple(0xF601);
+        }
+    }
+
+    /* Hash body, so that a partially written index is never trusted. */
+    {
+        struct sha256_state sha_ctx;
+        sha256_init(&sha_ctx);
+        sha256_update(&sha_ctx, body, body_size);
+        sha256_finalize(&sha_ctx);
+        sha256_finish(&sha_ctx, header.body_hash);
+    }
+    memcpy(index.get(), &header, sizeof(header));
+
+    Utils::SaveSdFileForAtmosphere(title_id, ROMFS_INDEX_FILE_PATH, index.get(), sizeof(header) + body_size);
+}
+
+void RomFSIndex::Invalidate(u64 title_id) {
+    Utils::DeleteSdFileForAtmosphere(title_id, ROMFS_INDEX_FILE_PATH);
+}
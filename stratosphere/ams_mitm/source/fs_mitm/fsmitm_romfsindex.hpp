@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2018 Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <switch.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "fsmitm_romstorage.hpp"
+#include "fsmitm_romfsbuild.hpp"
+
+#define ROMFS_INDEX_FILE_PATH "romfs_index.bin"
+
+#define ROMFS_INDEX_MAGIC 0x49534652 /* "RFSI" */
+#define ROMFS_INDEX_VERSION 2
+#define ROMFS_INDEX_FINGERPRINT_SIZE 0x20
+
+/* On-SD index of a previously built virtual RomFS layout. */
+/* Layout: header, source info table, string table, memory data, manifest. */
+struct RomFSIndexHeader {
+    u32 magic;
+    u32 version;
+    u8  fingerprint[ROMFS_INDEX_FINGERPRINT_SIZE];
+    u8  structure_fingerprint[ROMFS_INDEX_FINGERPRINT_SIZE];
+    u8  body_hash[ROMFS_INDEX_FINGERPRINT_SIZE];
+    u64 metadata_size;
+    u32 num_source_infos;
+    u32 string_table_size;
+    u64 memory_data_size;
+    u32 num_manifest_entries;
+    u32 reserved;
+};
+
+static_assert(sizeof(RomFSIndexHeader) == 0x88, "Incorrect RomFSIndexHeader definition!");
+
+struct RomFSIndexSourceInfo {
+    u64 virtual_offset;
+    u64 size;
+    /* Source offset for Base/File RomFS, string table offset for LooseFile, data offset for Memory. */
+    u64 arg;
+    u32 type;
+    u32 reserved;
+};
+
+static_assert(sizeof(RomFSIndexSourceInfo) == 0x20, "Incorrect RomFSIndexSourceInfo definition!");
+
+/* Sizes of the files in the SD romfs tree, by their path in the RomFS. */
+using RomFSSdFileSizes = std::unordered_map<std::string, u64>;
+
+class RomFSIndex {
+    public:
+        /* Hashes everything the virtual RomFS layout depends on: the SD romfs tree's names, types and sizes, */
+        /* and the headers and tables of the base/file RomFS. File contents are read at runtime, and do not matter. */
+        /* The structure fingerprint covers the same, except for the sizes of SD files, which are output instead. */
+        static void CalculateFingerprint(u64 title_id, IROStorage *file_romfs, IROStorage *storage_romfs, u8 *out_fingerprint, u8 *out_structure_fingerprint, RomFSSdFileSizes *out_sizes);
+
+        static bool Load(u64 title_id, const u8 *fingerprint, std::vector<RomFSSourceInfo> *out_infos);
+        /* If only the sizes of SD files changed since the indexed layout was built, moves its files and patches its metadata in place. */
+        static bool Update(u64 title_id, const u8 *fingerprint, const u8 *structure_fingerprint, const RomFSSdFileSizes *sizes, std::vector<RomFSSourceInfo> *out_infos);
+        static void Save(u64 title_id, const u8 *fingerprint, const u8 *structure_fingerprint, const std::vector<RomFSSourceInfo> *infos, const std::vector<RomFSManifestEntry> *manifest);
+        static void Invalidate(u64 title_id);
+};
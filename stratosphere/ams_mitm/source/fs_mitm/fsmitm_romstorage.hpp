@@ -17,13 +17,26 @@
 #pragma once
 #include <switch.h>
 #include <stratosphere.hpp>
+#include <atomic>
 
 #include "fs_istorage.hpp"
 
+struct RomFileStorageStats {
+    u64 reads;
+    /* Reads the file returned fewer bytes for than requested, at least once. */
+    u64 short_reads;
+    u64 fs_read_calls;
+    u64 bytes_read;
+};
+
 /* Represents a RomFS stored in some file. */
 class RomFileStorage : public IROStorage {
     private:
         FsFile *base_file;
+        std::atomic<u64> num_reads = 0;
+        std::atomic<u64> num_short_reads = 0;
+        std::atomic<u64> num_fs_read_calls = 0;
+        std::atomic<u64> num_bytes_read = 0;
     public:
         RomFileStorage(FsFile *f) : base_file(f) {
             /* ... */
@@ -35,12 +48,34 @@ class RomFileStorage : public IROStorage {
             fsFileClose(base_file);
             delete base_file;
         };
+        
+        void GetStats(RomFileStorageStats *out) const {
+            out->reads = this->num_reads;
+            out->short_reads = this->num_short_reads;
+            out->fs_read_calls = this->num_fs_read_calls;
+            out->bytes_read = this->num_bytes_read;
+        }
     public:
         Result Read(void *buffer, size_t size, u64 offset) override {
-            size_t out_sz = 0;
-            Result rc = fsFileRead(this->base_file, offset, buffer, size, &out_sz);
-            if (R_SUCCEEDED(rc) && out_sz != size && out_sz) {
-                return this->Read((void *)((uintptr_t)buffer + out_sz), size - out_sz, offset + out_sz);
+            Result rc = 0;
+            size_t read_so_far = 0;
+            u64 fs_read_calls = 0;
+            
+            /* Keep asking for whatever remains until the file stops returning data. */
+            while (read_so_far < size) {
+                size_t out_sz = 0;
+                fs_read_calls++;
+                if (R_FAILED((rc = fsFileRead(this->base_file, offset + read_so_far, (void *)((uintptr_t)buffer + read_so_far), size - read_so_far, &out_sz))) || out_sz == 0) {
+                    break;
+                }
+                read_so_far += out_sz;
+            }
+            
+            this->num_reads++;
+            this->num_fs_read_calls += fs_read_calls;
+            this->num_bytes_read += read_so_far;
+            if (fs_read_calls > 1 || read_so_far != size) {
+                this->num_short_reads++;
             }
             return rc;
         };
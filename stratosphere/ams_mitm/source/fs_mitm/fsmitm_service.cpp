@@ -27,38 +27,28 @@
 #include "fsmitm_boot0storage.hpp"
 #include "fsmitm_romstorage.hpp"
 #include "fsmitm_layeredrom.hpp"
+#include "fsmitm_cachedstorage.hpp"
+#include "fsmitm_storagecache.hpp"
 
 #include "../debug.hpp"
 
-static HosMutex g_StorageCacheLock;
-static std::unordered_map<u64, std::weak_ptr<IStorageInterface>> g_StorageCache;
-
-static bool StorageCacheGetEntry(u64 title_id, std::shared_ptr<IStorageInterface> *out) {
-    std::scoped_lock<HosMutex> lock(g_StorageCacheLock);
-    if (g_StorageCache.find(title_id) == g_StorageCache.end()) {
-        return false;
-    }
-    
-    auto intf = g_StorageCache[title_id].lock();
-    if (intf != nullptr) {
-        *out = intf;
-        return true;
+/* Wrap read-only storages in a block cache, for titles that opt in. */
+/* Only storages nothing else can write to may be cached, or the cache would go stale. */
+static IStorage *MakeCachedStorageIfEnabled(IROStorage *storage, u64 title_id, CachedStorage **out_cached_storage) {
+    *out_cached_storage = nullptr;
+    if (Utils::HasFlag(title_id, "storage_cache")) {
+        *out_cached_storage = new CachedStorage(storage);
+        return *out_cached_storage;
     }
-    return false;
+    return storage;
 }
 
-static void StorageCacheSetEntry(u64 title_id, std::shared_ptr<IStorageInterface> *ptr) {
-    std::scoped_lock<HosMutex> lock(g_StorageCacheLock);
-    
-    /* Ensure we always use the cached copy if present. */
-    if (g_StorageCache.find(title_id) != g_StorageCache.end()) {
-        auto intf = g_StorageCache[title_id].lock();
-        if (intf != nullptr) {
-            *ptr = intf;
-        }
+/* Count and trace operations on storages, for titles that opt in. */
+static IStorage *MakeStatsStorageIfEnabled(IStorage *storage, u64 title_id, StorageStatsKind kind, u32 id = 0, const LayeredRomFS *romfs = nullptr, CachedStorage *cached_storage = nullptr) {
+    if (Utils::HasFlag(title_id, "storage_stats")) {
+        return new StatsStorage(storage, title_id, kind, id, romfs, cached_storage);
     }
-    
-    g_StorageCache[title_id] = *ptr;
+    return storage;
 }
 
 void FsMitmService::PostProcess(IMitmServiceObject *obj, IpcResponseContext *ctx) {
@@ -103,23 +93,24 @@ Result FsMitmService::OpenBisStorage(Out<std::shared_ptr<IStorageInterface>> out
             const bool has_bis_write_flag = Utils::HasFlag(this->title_id, "bis_write");
             const bool has_cal0_read_flag = Utils::HasFlag(this->title_id, "cal_read");
             if (bis_partition_id == BisStorageId_Boot0) {
-                storage = std::make_shared<IStorageInterface>(new Boot0Storage(bis_storage, this->title_id));
+                storage = std::make_shared<IStorageInterface>(MakeStatsStorageIfEnabled(new Boot0Storage(bis_storage, this->title_id), this->title_id, StorageStatsKind_Bis, bis_partition_id));
             } else if (bis_partition_id == BisStorageId_Prodinfo) {
                 /* PRODINFO should *never* be writable. */
                 if (is_sysmodule || has_cal0_read_flag) {
-                    storage = std::make_shared<IStorageInterface>(new ROProxyStorage(bis_storage));
+                    storage = std::make_shared<IStorageInterface>(MakeStatsStorageIfEnabled(new ROProxyStorage(bis_storage), this->title_id, StorageStatsKind_Bis, bis_partition_id));
                 } else {
                     /* Do not allow non-sysmodules to read *or* write CAL0. */
                     fsStorageClose(&bis_storage);
                     return 0x320002;
                 }
             } else {
+                /* BIS partitions are never block cached: even a read-only session would miss writes made through other sessions. */
                 if (is_sysmodule || has_bis_write_flag) {
                     /* Sysmodules should still be allowed to read and write. */
-                    storage = std::make_shared<IStorageInterface>(new ProxyStorage(bis_storage));
+                    storage = std::make_shared<IStorageInterface>(MakeStatsStorageIfEnabled(new ProxyStorage(bis_storage), this->title_id, StorageStatsKind_Bis, bis_partition_id));
                 } else {
                     /* Non-sysmodules should be allowed to read. */
-                    storage = std::make_shared<IStorageInterface>(new ROProxyStorage(bis_storage));
+                    storage = std::make_shared<IStorageInterface>(MakeStatsStorageIfEnabled(new ROProxyStorage(bis_storage), this->title_id, StorageStatsKind_Bis, bis_partition_id));
                 }
             }
             if (out_storage.IsDomain()) {
@@ -141,12 +132,12 @@ Result FsMitmService::OpenDataStorageByCurrentProcess(Out<std::shared_ptr<IStora
         return RESULT_FORWARD_TO_SESSION;
     }
     
-    bool has_cache = StorageCacheGetEntry(this->title_id, &storage);
+    bool has_cache = StorageCache::GetEntry(this->title_id, &storage);
     
     ON_SCOPE_EXIT {
         if (R_SUCCEEDED(rc)) {
             if (!has_cache) {
-                StorageCacheSetEntry(this->title_id, &storage);
+                StorageCache::SetEntry(this->title_id, &storage);
             }
             
             out_storage.SetValue(std::move(storage));
@@ -180,11 +171,14 @@ Result FsMitmService::OpenDataStorageByCurrentProcess(Out<std::shared_ptr<IStora
         if (R_SUCCEEDED(rc)) {
             if (Utils::HasSdRomfsContent(this->title_id)) {
                 /* TODO: Is there a sensible path that ends in ".romfs" we can use?" */
+                std::shared_ptr<RomFileStorage> file_romfs = nullptr;
                 if (R_SUCCEEDED(Utils::OpenSdFileForAtmosphere(this->title_id, "romfs.bin", FS_OPEN_READ, &data_file))) {
-                    storage = std::make_shared<IStorageInterface>(new LayeredRomFS(std::make_shared<RomInterfaceStorage>(data_storage), std::make_shared<RomFileStorage>(data_file), this->title_id));
-                } else {
-                    storage = std::make_shared<IStorageInterface>(new LayeredRomFS(std::make_shared<RomInterfaceStorage>(data_storage), nullptr, this->title_id));
+                    file_romfs = std::make_shared<RomFileStorage>(data_file);
                 }
+                LayeredRomFS *layered_romfs = new LayeredRomFS(std::make_shared<RomInterfaceStorage>(data_storage), file_romfs, this->title_id);
+                CachedStorage *cached_storage;
+                IStorage *romfs_storage = MakeCachedStorageIfEnabled(layered_romfs, this->title_id, &cached_storage);
+                storage = std::make_shared<IStorageInterface>(MakeStatsStorageIfEnabled(romfs_storage, this->title_id, StorageStatsKind_DataStorage, 0, layered_romfs, cached_storage));
                 if (out_storage.IsDomain()) {
                     out_domain_id = data_storage.s.object_id;
                 }
@@ -213,12 +207,12 @@ Result FsMitmService::OpenDataStorageByDataId(Out<std::shared_ptr<IStorageInterf
     u32 out_domain_id = 0;
     Result rc = 0;
     
-    bool has_cache = StorageCacheGetEntry(data_id, &storage);
+    bool has_cache = StorageCache::GetEntry(data_id, &storage);
     
     ON_SCOPE_EXIT {
         if (R_SUCCEEDED(rc)) {
             if (!has_cache) {
-                StorageCacheSetEntry(data_id, &storage);
+                StorageCache::SetEntry(data_id, &storage);
             }
             
             out_storage.SetValue(std::move(storage));
@@ -247,11 +241,14 @@ Result FsMitmService::OpenDataStorageByDataId(Out<std::shared_ptr<IStorageInterf
         if (R_SUCCEEDED(rc)) {
             if (Utils::HasSdRomfsContent(data_id)) {
                 /* TODO: Is there a sensible path that ends in ".romfs" we can use?" */
+                std::shared_ptr<RomFileStorage> file_romfs = nullptr;
                 if (R_SUCCEEDED(Utils::OpenSdFileForAtmosphere(data_id, "romfs.bin", FS_OPEN_READ, &data_file))) {
-                    storage = std::make_shared<IStorageInterface>(new LayeredRomFS(std::make_shared<RomInterfaceStorage>(data_storage), std::make_shared<RomFileStorage>(data_file), data_id));
-                } else {
-                    storage = std::make_shared<IStorageInterface>(new LayeredRomFS(std::make_shared<RomInterfaceStorage>(data_storage), nullptr, data_id));
+                    file_romfs = std::make_shared<RomFileStorage>(data_file);
                 }
+                LayeredRomFS *layered_romfs = new LayeredRomFS(std::make_shared<RomInterfaceStorage>(data_storage), file_romfs, data_id);
+                CachedStorage *cached_storage;
+                IStorage *romfs_storage = MakeCachedStorageIfEnabled(layered_romfs, data_id, &cached_storage);
+                storage = std::make_shared<IStorageInterface>(MakeStatsStorageIfEnabled(romfs_storage, data_id, StorageStatsKind_DataStorage, 0, layered_romfs, cached_storage));
                 if (out_storage.IsDomain()) {
                     out_domain_id = data_storage.s.object_id;
                 }
@@ -264,4 +261,39 @@ Result FsMitmService::OpenDataStorageByDataId(Out<std::shared_ptr<IStorageInterf
     }
     
     return rc;
-}
\ No newline at end of file
+}
+
+Result FsMitmService::GetStorageStats(OutBuffer<StorageStatsRecord> records, Out<u64> out_count, u64 offset) {
+    if (!this->IsPrivilegedCaller()) {
+        return 0x320002;
+    }
+    
+    out_count.SetValue(StorageStats::GetRecords(records.buffer, records.num_elements, offset));
+    return 0;
+}
+
+Result FsMitmService::GetStorageTrace(OutBuffer<StorageTraceEntry> entries, Out<u64> out_count) {
+    if (!this->IsPrivilegedCaller()) {
+        return 0x320002;
+    }
+    
+    out_count.SetValue(StorageStats::GetTrace(entries.buffer, entries.num_elements));
+    return 0;
+}
+
+Result FsMitmService::DumpStorageStats() {
+    if (!this->IsPrivilegedCaller()) {
+        return 0x320002;
+    }
+    
+    return StorageStats::DumpToSd(this->title_id);
+}
+
+Result FsMitmService::RefreshFlags() {
+    if (!this->IsPrivilegedCaller()) {
+        return 0x320002;
+    }
+    
+    Utils::RefreshFlagIndex();
+    return 0;
+}
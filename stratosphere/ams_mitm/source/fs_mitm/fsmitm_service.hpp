@@ -18,6 +18,7 @@
 #include <switch.h>
 #include <stratosphere.hpp>
 #include "fs_istorage.hpp"
+#include "fsmitm_storagestats.hpp"
 #include "../utils.hpp"
 
 enum FspSrvCmd : u32 {
@@ -25,18 +26,30 @@ enum FspSrvCmd : u32 {
     FspSrvCmd_OpenBisStorage = 12,
     FspSrvCmd_OpenDataStorageByCurrentProcess = 200,
     FspSrvCmd_OpenDataStorageByDataId = 202,
+    
+    FspSrvCmd_AtmosphereGetStorageStats = 65000,
+    FspSrvCmd_AtmosphereGetStorageTrace = 65001,
+    FspSrvCmd_AtmosphereDumpStorageStats = 65002,
+    FspSrvCmd_AtmosphereRefreshFlags = 65003,
 };
 
 class FsMitmService : public IMitmServiceObject {
     private:
         bool has_initialized = false;
         bool should_override_contents;
+        
+        bool IsPrivilegedCaller() const {
+            /* Only system modules and qlaunch may use the atmosphere extension commands. */
+            return this->title_id <= 0x0100000000001000ULL;
+        }
     public:
         FsMitmService(std::shared_ptr<Service> s, u64 pid) : IMitmServiceObject(s, pid) {
+            /* Check the override button first, as this also refreshes the title's flags. */
+            const bool has_override_button = Utils::HasOverrideButton(this->title_id);
             if (Utils::HasSdDisableMitMFlag(this->title_id)) {
                 this->should_override_contents = false;
             } else {
-                this->should_override_contents = (this->title_id >= 0x0100000000010000ULL || Utils::HasSdMitMFlag(this->title_id)) && Utils::HasOverrideButton(this->title_id);
+                this->should_override_contents = (this->title_id >= 0x0100000000010000ULL || Utils::HasSdMitMFlag(this->title_id)) && has_override_button;
             }
         }
         
@@ -64,10 +77,21 @@ class FsMitmService : public IMitmServiceObject {
         Result OpenBisStorage(Out<std::shared_ptr<IStorageInterface>> out, u32 bis_partition_id);
         Result OpenDataStorageByCurrentProcess(Out<std::shared_ptr<IStorageInterface>> out);
         Result OpenDataStorageByDataId(Out<std::shared_ptr<IStorageInterface>> out, u64 data_id, u8 storage_id);
+        
+        /* Atmosphere commands. */
+        Result GetStorageStats(OutBuffer<StorageStatsRecord> records, Out<u64> out_count, u64 offset);
+        Result GetStorageTrace(OutBuffer<StorageTraceEntry> entries, Out<u64> out_count);
+        Result DumpStorageStats();
+        Result RefreshFlags();
     public:
         DEFINE_SERVICE_DISPATCH_TABLE {
             MakeServiceCommandMeta<FspSrvCmd_OpenBisStorage, &FsMitmService::OpenBisStorage>(),
             MakeServiceCommandMeta<FspSrvCmd_OpenDataStorageByCurrentProcess, &FsMitmService::OpenDataStorageByCurrentProcess>(),
             MakeServiceCommandMeta<FspSrvCmd_OpenDataStorageByDataId, &FsMitmService::OpenDataStorageByDataId>(),
+            
+            MakeServiceCommandMeta<FspSrvCmd_AtmosphereGetStorageStats, &FsMitmService::GetStorageStats>(),
+            MakeServiceCommandMeta<FspSrvCmd_AtmosphereGetStorageTrace, &FsMitmService::GetStorageTrace>(),
+            MakeServiceCommandMeta<FspSrvCmd_AtmosphereDumpStorageStats, &FsMitmService::DumpStorageStats>(),
+            MakeServiceCommandMeta<FspSrvCmd_AtmosphereRefreshFlags, &FsMitmService::RefreshFlags>(),
         };
 };
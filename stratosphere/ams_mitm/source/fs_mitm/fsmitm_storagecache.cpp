@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2018 Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <switch.h>
+#include <stratosphere.hpp>
+#include <unordered_map>
+
+#include "fsmitm_storagecache.hpp"
+
+struct StorageCacheShard {
+    HosMutex lock;
+    std::unordered_map<u64, std::weak_ptr<IStorageInterface>> entries;
+    u64 hits;
+    u64 misses;
+    u64 reaped;
+};
+
+static StorageCacheShard g_shards[StorageCache::NumShards];
+
+static StorageCacheShard *GetShard(u64 title_id) {
+    /* Title ids share most of their low bits, so mix before picking a shard. */
+    static_assert((StorageCache::NumShards & (StorageCache::NumShards - 1)) == 0, "Shard count must be a power of two!");
+    return &g_shards[((title_id * 0x9E3779B97F4A7C15ul) >> 32) & (StorageCache::NumShards - 1)];
+}
+
+static void ReapExpiredEntries(StorageCacheShard *shard) {
+    for (auto it = shard->entries.begin(); it != shard->entries.end();) {
+        if (it->second.expired()) {
+            it = shard->entries.erase(it);
+            shard->reaped++;
+        } else {
+            it++;
+        }
+    }
+}
+
+bool StorageCache::GetEntry(u64 title_id, std::shared_ptr<IStorageInterface> *out) {
+    StorageCacheShard *shard = GetShard(title_id);
+    std::scoped_lock<HosMutex> lk(shard->lock);
+    
+    auto it = shard->entries.find(title_id);
+    if (it != shard->entries.end()) {
+        auto intf = it->second.lock();
+        if (intf != nullptr) {
+            *out = intf;
+            shard->hits++;
+            return true;
+        }
+        shard->entries.erase(it);
+        shard->reaped++;
+    }
+    shard->misses++;
+    return false;
+}
+
+void StorageCache::SetEntry(u64 title_id, std::shared_ptr<IStorageInterface> *ptr) {
+    StorageCacheShard *shard = GetShard(title_id);
+    std::scoped_lock<HosMutex> lk(shard->lock);
+    
+    /* Ensure we always use the cached copy if present. */
+    auto it = shard->entries.find(title_id);
+    if (it != shard->entries.end()) {
+        auto intf = it->second.lock();
+        if (intf != nullptr) {
+            *ptr = intf;
+            return;
+        }
+    }
+    
+    /* Drop storages nobody holds anymore while we're here, so the shard doesn't grow without bound. */
+    ReapExpiredEntries(shard);
+    shard->entries[title_id] = *ptr;
+}
+
+void StorageCache::GetStats(StorageCacheStats *out) {
+    *out = {};
+    for (size_t i = 0; i < NumShards; i++) {
+        std::scoped_lock<HosMutex> lk(g_shards[i].lock);
+        out->hits += g_shards[i].hits;
+        out->misses += g_shards[i].misses;
+        out->reaped += g_shards[i].reaped;
+        out->num_entries += g_shards[i].entries.size();
+    }
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2018 Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <switch.h>
+#include <stratosphere.hpp>
+
+#include "fs_istorage.hpp"
+
+struct StorageCacheStats {
+    u64 hits;
+    u64 misses;
+    /* Expired entries removed from the cache. */
+    u64 reaped;
+    u64 num_entries;
+};
+
+/* Shares open data storages between processes, so that each title's RomFS is only built once while in use. */
+class StorageCache {
+    public:
+        static constexpr size_t NumShards = 8;
+    public:
+        static bool GetEntry(u64 title_id, std::shared_ptr<IStorageInterface> *out);
+        /* If another storage was cached for the title in the meantime, ptr is replaced with it. */
+        static void SetEntry(u64 title_id, std::shared_ptr<IStorageInterface> *ptr);
+        static void GetStats(StorageCacheStats *out);
+};
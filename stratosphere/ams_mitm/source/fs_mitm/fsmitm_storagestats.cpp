@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2018 Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <switch.h>
+#include <stratosphere.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "fsmitm_storagestats.hpp"
+#include "fsmitm_storagecache.hpp"
+#include "../utils.hpp"
+
+#include "../debug.hpp"
+
+/* The system tick runs at 19.2MHz. */
+static constexpr u64 SystemTickFrequency = 19200000;
+
+struct StorageStatsCounters {
+    u64 title_id;
+    StorageStatsKind kind;
+    u32 id;
+    std::atomic<u64> num_opened = 0;
+    std::atomic<u64> num_open = 0;
+    std::atomic<u64> reads = 0;
+    std::atomic<u64> writes = 0;
+    std::atomic<u64> errors = 0;
+    std::atomic<u64> bytes_read = 0;
+    std::atomic<u64> bytes_written = 0;
+    std::atomic<u64> total_us = 0;
+    std::atomic<u64> latency_histogram[StorageStatsLatencyBuckets] = {};
+    /* Layer stats of closed storages, protected by the registry lock. */
+    StorageLayerStats layers = {};
+};
+
+struct StorageTraceSlot {
+    /* Zero while the entry is being written. */
+    std::atomic<u64> sequence;
+    StorageTraceEntry entry;
+};
+
+static HosMutex g_stats_lock;
+static std::vector<std::unique_ptr<StorageStatsCounters>> g_counters;
+static std::vector<StatsStorage *> g_live_storages;
+
+static StorageTraceSlot g_trace[StorageStats::TraceEntryCount];
+static std::atomic<u64> g_trace_count = 0;
+
+static StorageStatsCounters *AcquireCounters(u64 title_id, StorageStatsKind kind, u32 id) {
+    for (auto &counters : g_counters) {
+        if (counters->title_id == title_id && counters->kind == kind && counters->id == id) {
+            return counters.get();
+        }
+    }
+
+    /* Stop tracking new storages once full, rather than growing without bound. */
+    if (g_counters.size() >= StorageStats::MaxRecords) {
+        return nullptr;
+    }
+
+    auto counters = std::make_unique<StorageStatsCounters>();
+    counters->title_id = title_id;
+    counters->kind = kind;
+    counters->id = id;
+    g_counters.push_back(std::move(counters));
+    return g_counters.back().get();
+}
+
+StatsStorage::StatsStorage(IStorage *s, u64 tid, StorageStatsKind k, u32 i, const LayeredRomFS *romfs, CachedStorage *cache) : base_storage(s), layered_romfs(romfs), cached_storage(cache), title_id(tid), kind(k), id(i) {
+    std::scoped_lock<HosMutex> lk(g_stats_lock);
+    this->counters = AcquireCounters(tid, k, i);
+    if (this->counters != nullptr) {
+        this->counters->num_opened++;
+        this->counters->num_open++;
+        g_live_storages.push_back(this);
+    }
+}
+
+StatsStorage::~StatsStorage() {
+    if (this->counters != nullptr) {
+        std::scoped_lock<HosMutex> lk(g_stats_lock);
+        /* Keep the layer stats around once the storages we wrap are gone. */
+        this->AddLayerStats(&this->counters->layers);
+        this->counters->num_open--;
+        g_live_storages.erase(std::find(g_live_storages.begin(), g_live_storages.end(), this));
+    }
+    delete base_storage;
+}
+
+void StatsStorage::AddLayerStats(StorageLayerStats *out) const {
+    if (this->layered_romfs != nullptr) {
+        LayeredRomFSStats stats;
+        this->layered_romfs->GetStats(&stats);
+        for (size_t i = 0; i < RomFSDataSourceCount; i++) {
+            out->source_bytes[i] += stats.source_bytes[i];
+        }
+        out->padding_bytes += stats.padding_bytes;
+        out->file_cache_hits += stats.file_cache.hits;
+        out->file_cache_misses += stats.file_cache.misses;
+        out->file_cache_evictions += stats.file_cache.evictions;
+        out->file_cache_ipcs_saved += stats.file_cache.ipcs_saved;
+        out->rom_file_reads += stats.file_romfs.reads;
+        out->rom_file_short_reads += stats.file_romfs.short_reads;
+        out->rom_file_fs_read_calls += stats.file_romfs.fs_read_calls;
+        out->rom_file_bytes_read += stats.file_romfs.bytes_read;
+    }
+    if (this->cached_storage != nullptr) {
+        CachedStorageStats stats;
+        this->cached_storage->GetStats(&stats);
+        out->block_cache_hits += stats.hits;
+        out->block_cache_misses += stats.misses;
+        out->block_cache_backend_reads += stats.backend_reads;
+        out->block_cache_backend_bytes += stats.backend_bytes;
+    }
+}
+
+void StatsStorage::OnOperation(StorageTraceOperation operation, u64 start_tick, size_t size, u64 offset, Result rc) {
+    const u64 us = (armGetSystemTick() - start_tick) * 1000000 / SystemTickFrequency;
+
+    if (this->counters != nullptr) {
+        StorageStatsCounters *c = this->counters;
+        if (operation == StorageTraceOperation_Read) {
+            c->reads++;
+        } else {
+            c->writes++;
+        }
+        if (R_SUCCEEDED(rc)) {
+            if (operation == StorageTraceOperation_Read) {
+                c->bytes_read += size;
+            } else {
+                c->bytes_written += size;
+            }
+        } else {
+            c->errors++;
+        }
+        c->total_us += us;
+        c->latency_histogram[GetStorageStatsLatencyBucket(us)]++;
+    }
+
+    /* Record the operation in the trace, marking the slot as busy while we fill it in. */
+    const u64 sequence = ++g_trace_count;
+    StorageTraceSlot *slot = &g_trace[(sequence - 1) % StorageStats::TraceEntryCount];
+    slot->sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->entry.sequence = sequence;
+    slot->entry.title_id = this->title_id;
+    slot->entry.offset = offset;
+    slot->entry.size = size;
+    slot->entry.duration_us = static_cast<u32>(std::min(us, static_cast<u64>(UINT32_MAX)));
+    slot->entry.rc = rc;
+    slot->entry.kind = this->kind;
+    slot->entry.id = static_cast<u16>(this->id);
+    slot->entry.operation = operation;
+    slot->entry.reserved = 0;
+    slot->sequence.store(sequence, std::memory_order_release);
+}
+
+Result StatsStorage::Read(void *buffer, size_t size, u64 offset) {
+    const u64 start_tick = armGetSystemTick();
+    Result rc = this->base_storage->Read(buffer, size, offset);
+    this->OnOperation(StorageTraceOperation_Read, start_tick, size, offset, rc);
+    return rc;
+}
+
+Result StatsStorage::Write(void *buffer, size_t size, u64 offset) {
+    const u64 start_tick = armGetSystemTick();
+    Result rc = this->base_storage->Write(buffer, size, offset);
+    this->OnOperation(StorageTraceOperation_Write, start_tick, size, offset, rc);
+    return rc;
+}
+
+Result StatsStorage::Flush() {
+    return this->base_storage->Flush();
+}
+
+Result StatsStorage::SetSize(u64 size) {
+    return this->base_storage->SetSize(size);
+}
+
+Result StatsStorage::GetSize(u64 *out_size) {
+    return this->base_storage->GetSize(out_size);
+}
+
+Result StatsStorage::OperateRange(u32 operation_type, u64 offset, u64 size, FsRangeInfo *out_range_info) {
+    return this->base_storage->OperateRange(operation_type, offset, size, out_range_info);
+}
+
+size_t StorageStats::GetRecords(StorageStatsRecord *out, size_t max_out, size_t offset) {
+    std::scoped_lock<HosMutex> lk(g_stats_lock);
+
+    size_t count = 0;
+    for (size_t i = offset; i < g_counters.size() && count < max_out; i++) {
+        const StorageStatsCounters *c = g_counters[i].get();
+        StorageStatsRecord *record = &out[count++];
+        std::memset(record, 0, sizeof(*record));
+        record->title_id = c->title_id;
+        record->kind = c->kind;
+        record->id = c->id;
+        record->num_opened = c->num_opened;
+        record->num_open = c->num_open;
+        record->reads = c->reads;
+        record->writes = c->writes;
+        record->errors = c->errors;
+        record->bytes_read = c->bytes_read;
+        record->bytes_written = c->bytes_written;
+        record->total_us = c->total_us;
+        for (size_t b = 0; b < StorageStatsLatencyBuckets; b++) {
+            record->latency_histogram[b] = c->latency_histogram[b];
+        }
+        record->layers = c->layers;
+
+        /* Add in the layer stats from storages that are still open. */
+        for (const auto storage : g_live_storages) {
+            if (storage->GetCounters() == c) {
+                storage->AddLayerStats(&record->layers);
+            }
+        }
+    }
+    return count;
+}
+
+size_t StorageStats::GetTrace(StorageTraceEntry *out, size_t max_out) {
+    const u64 last = g_trace_count;
+    const u64 num_entries = std::min(static_cast<u64>(std::min(max_out, TraceEntryCount)), last);
+
+    size_t count = 0;
+    for (u64 sequence = last - num_entries + 1; sequence <= last; sequence++) {
+        const StorageTraceSlot *slot = &g_trace[(sequence - 1) % TraceEntryCount];
+        if (slot->sequence.load(std::memory_order_acquire) != sequence) {
+            continue;
+        }
+        StorageTraceEntry entry = slot->entry;
+        /* Drop entries that were overwritten while we copied them. */
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot->sequence.load(std::memory_order_relaxed) != sequence) {
+            continue;
+        }
+        out[count++] = entry;
+    }
+    return count;
+}
+
+Result StorageStats::DumpToSd(u64 title_id) {
+    static const char * const KindNames[] = { "BIS", "DataStorage" };
+    static const char * const SourceNames[RomFSDataSourceCount] = { "Base", "File", "LooseFile", "MetaData", "Memory" };
+
+    std::string dump;
+    char line[0x100];
+
+    StorageStatsRecord record;
+    for (size_t i = 0; GetRecords(&record, 1, i) == 1; i++) {
+        if (record.title_id != title_id) {
+            continue;
+        }
+
+        snprintf(line, sizeof(line), "[%s %u]\nopened=%lu open=%lu reads=%lu writes=%lu errors=%lu\nbytes_read=%lu bytes_written=%lu total_us=%lu\n",
+                 record.kind < sizeof(KindNames) / sizeof(KindNames[0]) ? KindNames[record.kind] : "Unknown", record.id, record.num_opened, record.num_open,
+                 record.reads, record.writes, record.errors, record.bytes_read, record.bytes_written, record.total_us);
+        dump += line;
+
+        dump += "latency_us:";
+        for (size_t b = 0; b < StorageStatsLatencyBuckets; b++) {
+            if (b < StorageStatsLatencyBuckets - 1) {
+                snprintf(line, sizeof(line), " <%lu=%lu", 1ul << b, record.latency_histogram[b]);
+            } else {
+                snprintf(line, sizeof(line), " >=%lu=%lu", 1ul << (b - 1), record.latency_histogram[b]);
+            }
+            dump += line;
+        }
+        dump += "\n";
+
+        dump += "source_bytes:";
+        for (size_t s = 0; s < RomFSDataSourceCount; s++) {
+            snprintf(line, sizeof(line), " %s=%lu", SourceNames[s], record.layers.source_bytes[s]);
+            dump += line;
+        }
+        snprintf(line, sizeof(line), " Padding=%lu\n", record.layers.padding_bytes);
+        dump += line;
+
+        snprintf(line, sizeof(line), "file_cache: hits=%lu misses=%lu evictions=%lu ipcs_saved=%lu\n", record.layers.file_cache_hits,
+                 record.layers.file_cache_misses, record.layers.file_cache_evictions, record.layers.file_cache_ipcs_saved);
+        dump += line;
+
+        snprintf(line, sizeof(line), "rom_file: reads=%lu short_reads=%lu fs_read_calls=%lu bytes_read=%lu\n", record.layers.rom_file_reads,
+                 record.layers.rom_file_short_reads, record.layers.rom_file_fs_read_calls, record.layers.rom_file_bytes_read);
+        dump += line;
+
+        snprintf(line, sizeof(line), "block_cache: hits=%lu misses=%lu backend_reads=%lu backend_bytes=%lu\n\n", record.layers.block_cache_hits,
+                 record.layers.block_cache_misses, record.layers.block_cache_backend_reads, record.layers.block_cache_backend_bytes);
+        dump += line;
+    }
+
+    /* The storage cache is shared by every title, so its stats are global. */
+    StorageCacheStats cache_stats;
+    StorageCache::GetStats(&cache_stats);
+    snprintf(line, sizeof(line), "[StorageCache]\nhits=%lu misses=%lu reaped=%lu entries=%lu\n", cache_stats.hits, cache_stats.misses, cache_stats.reaped, cache_stats.num_entries);
+    dump += line;
+
+    return Utils::SaveSdFileForAtmosphere(title_id, STORAGE_STATS_FILE_PATH, dump.data(), dump.size());
+}
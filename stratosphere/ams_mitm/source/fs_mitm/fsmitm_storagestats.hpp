@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2018 Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <switch.h>
+#include <stratosphere.hpp>
+#include <atomic>
+
+#include "fs_istorage.hpp"
+#include "fsmitm_layeredrom.hpp"
+#include "fsmitm_cachedstorage.hpp"
+
+#define STORAGE_STATS_FILE_PATH "fsmitm_stats.txt"
+
+enum StorageStatsKind : u32 {
+    StorageStatsKind_Bis = 0,
+    StorageStatsKind_DataStorage = 1,
+};
+
+enum StorageTraceOperation : u8 {
+    StorageTraceOperation_Read = 0,
+    StorageTraceOperation_Write = 1,
+};
+
+/* Bucket 0 counts operations under 1us, bucket i operations in [2^(i-1), 2^i) us; the last bucket takes the rest. */
+static constexpr size_t StorageStatsLatencyBuckets = 16;
+
+static inline size_t GetStorageStatsLatencyBucket(u64 us) {
+    const size_t bucket = us ? 64 - __builtin_clzll(us) : 0;
+    return bucket < StorageStatsLatencyBuckets ? bucket : StorageStatsLatencyBuckets - 1;
+}
+
+/* Counters kept by the storages a StatsStorage wraps, rather than by the StatsStorage itself. */
+struct StorageLayerStats {
+    /* Bytes served by LayeredRomFS, indexed by RomFSDataSource. */
+    u64 source_bytes[RomFSDataSourceCount];
+    u64 padding_bytes;
+    /* LayeredRomFS's cache of open SD files. */
+    u64 file_cache_hits;
+    u64 file_cache_misses;
+    u64 file_cache_evictions;
+    u64 file_cache_ipcs_saved;
+    /* LayeredRomFS's romfs.bin, if any. */
+    u64 rom_file_reads;
+    u64 rom_file_short_reads;
+    u64 rom_file_fs_read_calls;
+    u64 rom_file_bytes_read;
+    /* Block cache in front of the storage, for titles that enable it. */
+    u64 block_cache_hits;
+    u64 block_cache_misses;
+    u64 block_cache_backend_reads;
+    u64 block_cache_backend_bytes;
+};
+
+/* Exported through IPC and the SD dump, so the layout is fixed. */
+struct StorageStatsRecord {
+    u64 title_id;
+    u32 kind;
+    /* BIS partition id, for BIS storages. */
+    u32 id;
+    u64 num_opened;
+    u64 num_open;
+    u64 reads;
+    u64 writes;
+    u64 errors;
+    u64 bytes_read;
+    u64 bytes_written;
+    u64 total_us;
+    u64 latency_histogram[StorageStatsLatencyBuckets];
+    StorageLayerStats layers;
+};
+
+struct StorageTraceEntry {
+    /* Entries are numbered from one, in the order operations completed. */
+    u64 sequence;
+    u64 title_id;
+    u64 offset;
+    u64 size;
+    u32 duration_us;
+    Result rc;
+    u32 kind;
+    u16 id;
+    u8 operation;
+    u8 reserved;
+};
+static_assert(sizeof(StorageTraceEntry) == 0x30, "Incorrect StorageTraceEntry definition!");
+
+struct StorageStatsCounters;
+
+/* Counts reads and writes to some other storage, and records them in the trace. */
+class StatsStorage : public IStorage {
+    private:
+        IStorage *base_storage;
+        StorageStatsCounters *counters;
+        /* If set, their stats are folded into our counters. */
+        const LayeredRomFS *layered_romfs;
+        CachedStorage *cached_storage;
+        u64 title_id;
+        StorageStatsKind kind;
+        u32 id;
+    private:
+        void OnOperation(StorageTraceOperation operation, u64 start_tick, size_t size, u64 offset, Result rc);
+    public:
+        StatsStorage(IStorage *s, u64 tid, StorageStatsKind k, u32 i = 0, const LayeredRomFS *romfs = nullptr, CachedStorage *cache = nullptr);
+        virtual ~StatsStorage();
+
+        const StorageStatsCounters *GetCounters() const {
+            return this->counters;
+        }
+        /* Adds the stats of the storages we wrap to out. */
+        void AddLayerStats(StorageLayerStats *out) const;
+    public:
+        virtual Result Read(void *buffer, size_t size, u64 offset) override;
+        virtual Result Write(void *buffer, size_t size, u64 offset) override;
+        virtual Result Flush() override;
+        virtual Result SetSize(u64 size) override;
+        virtual Result GetSize(u64 *out_size) override;
+        virtual Result OperateRange(u32 operation_type, u64 offset, u64 size, FsRangeInfo *out_range_info) override;
+};
+
+class StorageStats {
+    public:
+        static constexpr size_t MaxRecords = 0x80;
+        static constexpr size_t TraceEntryCount = 0x100;
+    public:
+        /* Copies records starting at the offset-th, returning how many were copied. */
+        static size_t GetRecords(StorageStatsRecord *out, size_t max_out, size_t offset);
+        /* Copies the most recent trace entries, oldest first, returning how many were copied. */
+        static size_t GetTrace(StorageTraceEntry *out, size_t max_out);
+        /* Writes a readable summary of a title's records, and of the storage cache, to its atmosphere directory. */
+        static Result DumpToSd(u64 title_id);
+};
@@ -16,9 +16,13 @@
 
 #include <mutex>
 #include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <map>
+#include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 #include <switch.h>
 #include <strings.h>
 #include <ctype.h>
@@ -32,7 +36,26 @@ struct SettingsItemValue {
     u8 *data;
 };
 
-std::map<std::string, SettingsItemValue> g_settings_items;
+/* Items are staged here while parsing, keyed by (name, key). */
+static std::map<std::pair<std::string, std::string>, SettingsItemValue> g_staged_settings_items;
+
+/* Immutable lookup table, built once parsing is done. */
+struct SettingsItemEntry {
+    /* Name, key and value are stored back to back in the arena, starting here. */
+    u32 offset;
+    u32 value_size;
+    u16 name_len;
+    u16 key_len;
+};
+
+struct SettingsItemTable {
+    /* Sorted by name, then key. */
+    std::vector<SettingsItemEntry> entries;
+    std::unique_ptr<u8[]> arena;
+};
+
+static SettingsItemTable g_settings_table;
+static std::atomic_bool g_has_settings_table = false;
 
 static bool g_threw_fatal = false;
 static HosThread g_fatal_thread;
@@ -154,7 +177,6 @@ static Result ParseValue(const char *name, const char *key, const char *val_tup)
         return 0x20E69;
     }
     
-    std::string kv = std::string(name) + "!" + std::string(key);
     SettingsItemValue value;
     
     if (strncasecmp(type, "str", type_len) == 0 || strncasecmp(type, "string", type_len) == 0) {
@@ -221,7 +243,14 @@ static Result ParseValue(const char *name, const char *key, const char *val_tup)
         return 0x20E69;
     }
     
-    g_settings_items[kv] = value;
+    /* Later values replace earlier ones. */
+    auto it = g_staged_settings_items.find(std::make_pair(std::string(name), std::string(key)));
+    if (it != g_staged_settings_items.end()) {
+        free(it->second.data);
+        it->second = value;
+    } else {
+        g_staged_settings_items.emplace(std::make_pair(std::string(name), std::string(key)), value);
+    }
     return 0x0;
 }
 
@@ -242,6 +271,82 @@ static int SettingsItemIniHandler(void *user, const char *name, const char *key,
     return R_SUCCEEDED(rc) ? 1 : 0;
 }
 
+static void BuildSettingsTable() {
+    /* Lay out every item in a single allocation. */
+    size_t arena_size = 0;
+    for (const auto &it : g_staged_settings_items) {
+        arena_size += it.first.first.size() + it.first.second.size() + it.second.size;
+    }
+    
+    g_settings_table.entries.reserve(g_staged_settings_items.size());
+    g_settings_table.arena = std::make_unique<u8[]>(arena_size);
+    
+    /* The staging map is already ordered by name, then key. */
+    u8 *arena = g_settings_table.arena.get();
+    size_t offset = 0;
+    for (auto &it : g_staged_settings_items) {
+        const std::string &name = it.first.first;
+        const std::string &key = it.first.second;
+        
+        SettingsItemEntry entry;
+        entry.offset = static_cast<u32>(offset);
+        entry.value_size = static_cast<u32>(it.second.size);
+        entry.name_len = static_cast<u16>(name.size());
+        entry.key_len = static_cast<u16>(key.size());
+        g_settings_table.entries.push_back(entry);
+        
+        std::memcpy(arena + offset, name.data(), name.size());
+        offset += name.size();
+        std::memcpy(arena + offset, key.data(), key.size());
+        offset += key.size();
+        std::memcpy(arena + offset, it.second.data, it.second.size);
+        offset += it.second.size;
+        
+        free(it.second.data);
+    }
+    g_staged_settings_items.clear();
+    
+    g_has_settings_table = true;
+}
+
+static int CompareString(const u8 *a, size_t a_len, const char *b, size_t b_len) {
+    const int cmp = std::memcmp(a, b, std::min(a_len, b_len));
+    if (cmp != 0) {
+        return cmp;
+    }
+    return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+}
+
+static const SettingsItemEntry *FindSettingsItem(const char *name, const char *key) {
+    if (!g_has_settings_table) {
+        return nullptr;
+    }
+    
+    const size_t name_len = strnlen(name, SettingsItemManager::MaxNameLength + 1);
+    const size_t key_len = strnlen(key, SettingsItemManager::MaxKeyLength + 1);
+    const u8 *arena = g_settings_table.arena.get();
+    
+    /* Binary search, comparing name then key in place. */
+    size_t lo = 0, hi = g_settings_table.entries.size();
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const SettingsItemEntry *entry = &g_settings_table.entries[mid];
+        int cmp = CompareString(arena + entry->offset, entry->name_len, name, name_len);
+        if (cmp == 0) {
+            cmp = CompareString(arena + entry->offset + entry->name_len, entry->key_len, key, key_len);
+        }
+        
+        if (cmp == 0) {
+            return entry;
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return nullptr;
+}
+
 void SettingsItemManager::LoadConfiguration() {    
     /* Open file. */
     FsFile config_file;
@@ -270,6 +375,9 @@ void SettingsItemManager::LoadConfiguration() {
         ini_parse_string(config_buf, SettingsItemIniHandler, &rc);
     }
     
+    /* Items parsed before any error remain usable. */
+    BuildSettingsTable();
+    
     /* Report error if we encountered one. */
     if (R_FAILED(rc) && !g_threw_fatal) {
         g_threw_fatal = true;
@@ -279,31 +387,27 @@ void SettingsItemManager::LoadConfiguration() {
 }
 
 Result SettingsItemManager::GetValueSize(const char *name, const char *key, u64 *out_size) {
-    std::string kv = std::string(name) + "!" + std::string(key);
-    
-    auto it = g_settings_items.find(kv);
-    if (it == g_settings_items.end()) {
+    const SettingsItemEntry *entry = FindSettingsItem(name, key);
+    if (entry == nullptr) {
         return 0x1669;
     }
     
-    *out_size = it->second.size;
+    *out_size = entry->value_size;
     return 0x0;
 }
 
 Result SettingsItemManager::GetValue(const char *name, const char *key, void *out, size_t max_size, u64 *out_size) {
-    std::string kv = std::string(name) + "!" + std::string(key);
-    
-    auto it = g_settings_items.find(kv);
-    if (it == g_settings_items.end()) {
+    const SettingsItemEntry *entry = FindSettingsItem(name, key);
+    if (entry == nullptr) {
         return 0x1669;
     }
     
-    size_t copy_size = it->second.size;
+    size_t copy_size = entry->value_size;
     if (max_size < copy_size) {
         copy_size = max_size;
     }
     *out_size = copy_size;
     
-    memcpy(out, it->second.data, copy_size);
+    memcpy(out, g_settings_table.arena.get() + entry->offset + entry->name_len + entry->key_len, copy_size);
     return 0x0;
 }
@@ -19,6 +19,10 @@
 #include <atomic>
 #include <algorithm>
 #include <strings.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "debug.hpp"
 #include "utils.hpp"
@@ -30,8 +34,16 @@
 static FsFileSystem g_sd_filesystem = {0};
 static HosSignal g_sd_signal;
 
-static std::vector<u64> g_mitm_flagged_tids;
-static std::vector<u64> g_disable_mitm_flagged_tids;
+/* In-memory index of flag files, so that checking a flag doesn't touch the SD card. */
+struct FlagIndex {
+    std::unordered_set<u64> mitm_flagged_tids;
+    std::unordered_set<u64> disable_mitm_flagged_tids;
+    std::unordered_map<u64, std::vector<std::string>> title_flags;
+    std::vector<std::string> global_flags;
+};
+
+static HosMutex g_flag_index_lock;
+static FlagIndex g_flag_index;
 static std::atomic_bool g_has_initialized = false;
 static std::atomic_bool g_has_hid_session = false;
 
@@ -147,57 +159,8 @@ void Utils::InitializeThreadFunc(void *args) {
         }
     }
     
-    /* Check for MitM flags. */
-    FsDir titles_dir;
-    if (R_SUCCEEDED(fsFsOpenDirectory(&g_sd_filesystem, "/atmosphere/titles", FS_DIROPEN_DIRECTORY, &titles_dir))) {
-        FsDirectoryEntry dir_entry;
-        FsFile f;
-        u64 read_entries;
-        while (R_SUCCEEDED((fsDirRead(&titles_dir, 0, &read_entries, 1, &dir_entry))) && read_entries == 1) {
-            if (strlen(dir_entry.name) == 0x10 && IsHexadecimal(dir_entry.name)) {
-                u64 title_id = strtoul(dir_entry.name, NULL, 16);
-                char title_path[FS_MAX_PATH] = {0};
-                strcpy(title_path, "/atmosphere/titles/");
-                strcat(title_path, dir_entry.name);
-                strcat(title_path, "/flags/fsmitm.flag");
-                if (R_SUCCEEDED(fsFsOpenFile(&g_sd_filesystem, title_path, FS_OPEN_READ, &f))) {
-                    g_mitm_flagged_tids.push_back(title_id);
-                    fsFileClose(&f);
-                } else {
-                    /* TODO: Deprecate. */
-                    memset(title_path, 0, sizeof(title_path));
-                    strcpy(title_path, "/atmosphere/titles/");
-                    strcat(title_path, dir_entry.name);
-                    strcat(title_path, "/fsmitm.flag");
-                    if (R_SUCCEEDED(fsFsOpenFile(&g_sd_filesystem, title_path, FS_OPEN_READ, &f))) {
-                        g_mitm_flagged_tids.push_back(title_id);
-                        fsFileClose(&f);
-                    }
-                }
-                
-                memset(title_path, 0, sizeof(title_path));
-                strcpy(title_path, "/atmosphere/titles/");
-                strcat(title_path, dir_entry.name);
-                strcat(title_path, "/flags/fsmitm_disable.flag");
-                if (R_SUCCEEDED(fsFsOpenFile(&g_sd_filesystem, title_path, FS_OPEN_READ, &f))) {
-                    g_disable_mitm_flagged_tids.push_back(title_id);
-                    fsFileClose(&f);
-                } else {
-                    /* TODO: Deprecate. */
-                    memset(title_path, 0, sizeof(title_path));
-                    strcpy(title_path, "/atmosphere/titles/");
-                    strcat(title_path, dir_entry.name);
-                    strcat(title_path, "/fsmitm_disable.flag");
-                    if (R_SUCCEEDED(fsFsOpenFile(&g_sd_filesystem, title_path, FS_OPEN_READ, &f))) {
-                        g_disable_mitm_flagged_tids.push_back(title_id);
-                        fsFileClose(&f);
-                    }
-                }
-            }
-        }
-        fsDirClose(&titles_dir);
-    }
-    
+    /* Build the flag index, and load loader.ini. */
+    Utils::RefreshFlagIndex();
     Utils::RefreshConfiguration();
     
     /* Initialize set:sys. */
@@ -383,41 +346,48 @@ Result Utils::SaveSdFileForAtmosphere(u64 title_id, const char *fn, void *data,
     return rc;
 }
 
+Result Utils::DeleteSdFileForAtmosphere(u64 title_id, const char *fn) {
+    if (!IsSdInitialized()) {
+        return 0xFA202;
+    }
+    
+    char path[FS_MAX_PATH];
+    if (*fn == '/') {
+        snprintf(path, sizeof(path), "/atmosphere/titles/%016lx%s", title_id, fn);
+    } else {
+        snprintf(path, sizeof(path), "/atmosphere/titles/%016lx/%s", title_id, fn);
+    }
+    
+    return fsFsDeleteFile(&g_sd_filesystem, path);
+}
+
 bool Utils::IsHblTid(u64 tid) {
     return (g_hbl_override_config.override_any_app && IsApplicationTid(tid)) || (!g_hbl_override_config.override_any_app && tid == g_hbl_override_config.title_id);
 }
 
-bool Utils::HasTitleFlag(u64 tid, const char *flag) {
-    if (IsSdInitialized()) {
-        FsFile f;
-        char flag_path[FS_MAX_PATH];
-        
-        memset(flag_path, 0, sizeof(flag_path));
-        snprintf(flag_path, sizeof(flag_path) - 1, "flags/%s.flag", flag);
-        if (OpenSdFileForAtmosphere(tid, flag_path, FS_OPEN_READ, &f)) {
-            fsFileClose(&f);
-            return true;
-        }
-        
-        /* TODO: Deprecate. */
-        snprintf(flag_path, sizeof(flag_path) - 1, "%s.flag", flag);
-        if (OpenSdFileForAtmosphere(tid, flag_path, FS_OPEN_READ, &f)) {
-            fsFileClose(&f);
+static bool HasFlagInList(const std::vector<std::string> &flags, const char *flag) {
+    /* The SD card is FAT, so flag names are case insensitive. */
+    for (const auto &cur_flag : flags) {
+        if (strcasecmp(cur_flag.c_str(), flag) == 0) {
             return true;
         }
     }
     return false;
 }
 
+bool Utils::HasTitleFlag(u64 tid, const char *flag) {
+    if (IsSdInitialized()) {
+        std::scoped_lock<HosMutex> lk(g_flag_index_lock);
+        auto it = g_flag_index.title_flags.find(tid);
+        return it != g_flag_index.title_flags.end() && HasFlagInList(it->second, flag);
+    }
+    return false;
+}
+
 bool Utils::HasGlobalFlag(const char *flag) {
     if (IsSdInitialized()) {
-        FsFile f;
-        char flag_path[FS_MAX_PATH] = {0};
-        snprintf(flag_path, sizeof(flag_path), "/atmosphere/flags/%s.flag", flag);
-        if (fsFsOpenFile(&g_sd_filesystem, flag_path, FS_OPEN_READ, &f)) {
-            fsFileClose(&f);
-            return true;
-        }
+        std::scoped_lock<HosMutex> lk(g_flag_index_lock);
+        return HasFlagInList(g_flag_index.global_flags, flag);
     }
     return false;
 }
@@ -438,14 +408,16 @@ bool Utils::HasSdMitMFlag(u64 tid) {
     }
     
     if (IsSdInitialized()) {
-        return std::find(g_mitm_flagged_tids.begin(), g_mitm_flagged_tids.end(), tid) != g_mitm_flagged_tids.end();
+        std::scoped_lock<HosMutex> lk(g_flag_index_lock);
+        return g_flag_index.mitm_flagged_tids.count(tid) != 0;
     }
     return false;
 }
 
 bool Utils::HasSdDisableMitMFlag(u64 tid) {
     if (IsSdInitialized()) {
-        return std::find(g_disable_mitm_flagged_tids.begin(), g_disable_mitm_flagged_tids.end(), tid) != g_disable_mitm_flagged_tids.end();
+        std::scoped_lock<HosMutex> lk(g_flag_index_lock);
+        return g_flag_index.disable_mitm_flagged_tids.count(tid) != 0;
     }
     return false;
 }
@@ -475,8 +447,9 @@ bool Utils::HasOverrideButton(u64 tid) {
         return true;
     }
     
-    /* Unconditionally refresh loader.ini contents. */
+    /* Unconditionally refresh loader.ini contents and the title's flags. */
     RefreshConfiguration();
+    RefreshTitleFlags(tid);
     
     if (IsHblTid(tid) && HasOverrideKey(&g_hbl_override_config.override_key)) {
         return true;
@@ -608,6 +581,100 @@ OverrideKey Utils::GetTitleOverrideKey(u64 tid) {
     return cfg;
 }
 
+static constexpr size_t FlagDirectoryEntryBatchCount = 0x40;
+
+static void AddFlagsInDirectory(const char *path, std::vector<std::string> *out) {
+    FsDir dir;
+    if (R_FAILED(fsFsOpenDirectory(&g_sd_filesystem, path, FS_DIROPEN_FILE, &dir))) {
+        return;
+    }
+    ON_SCOPE_EXIT { fsDirClose(&dir); };
+    
+    auto dir_entries = std::make_unique<FsDirectoryEntry[]>(FlagDirectoryEntryBatchCount);
+    u64 read_entries;
+    while (R_SUCCEEDED((fsDirRead(&dir, 0, &read_entries, FlagDirectoryEntryBatchCount, dir_entries.get()))) && read_entries > 0) {
+        for (u64 i = 0; i < read_entries; i++) {
+            const char *name = dir_entries[i].name;
+            const size_t name_len = strlen(name);
+            if (name_len > 5 && strcasecmp(name + name_len - 5, ".flag") == 0) {
+                out->emplace_back(name, name_len - 5);
+            }
+        }
+    }
+}
+
+static void ReadTitleFlags(u64 title_id, std::vector<std::string> *out) {
+    char title_path[FS_MAX_PATH] = {0};
+    
+    snprintf(title_path, sizeof(title_path), "/atmosphere/titles/%016lx/flags", title_id);
+    AddFlagsInDirectory(title_path, out);
+    
+    /* TODO: Deprecate. */
+    snprintf(title_path, sizeof(title_path), "/atmosphere/titles/%016lx", title_id);
+    AddFlagsInDirectory(title_path, out);
+}
+
+static void SetTitleFlags(FlagIndex *index, u64 title_id, std::vector<std::string> &&flags) {
+    index->mitm_flagged_tids.erase(title_id);
+    index->disable_mitm_flagged_tids.erase(title_id);
+    index->title_flags.erase(title_id);
+    
+    if (flags.empty()) {
+        return;
+    }
+    if (HasFlagInList(flags, "fsmitm")) {
+        index->mitm_flagged_tids.insert(title_id);
+    }
+    if (HasFlagInList(flags, "fsmitm_disable")) {
+        index->disable_mitm_flagged_tids.insert(title_id);
+    }
+    index->title_flags[title_id] = std::move(flags);
+}
+
+static void BuildFlagIndex(FlagIndex *out) {
+    AddFlagsInDirectory("/atmosphere/flags", &out->global_flags);
+    
+    FsDir titles_dir;
+    if (R_FAILED(fsFsOpenDirectory(&g_sd_filesystem, "/atmosphere/titles", FS_DIROPEN_DIRECTORY, &titles_dir))) {
+        return;
+    }
+    ON_SCOPE_EXIT { fsDirClose(&titles_dir); };
+    
+    auto dir_entries = std::make_unique<FsDirectoryEntry[]>(FlagDirectoryEntryBatchCount);
+    u64 read_entries;
+    while (R_SUCCEEDED((fsDirRead(&titles_dir, 0, &read_entries, FlagDirectoryEntryBatchCount, dir_entries.get()))) && read_entries > 0) {
+        for (u64 i = 0; i < read_entries; i++) {
+            if (strlen(dir_entries[i].name) == 0x10 && IsHexadecimal(dir_entries[i].name)) {
+                const u64 title_id = strtoul(dir_entries[i].name, NULL, 16);
+                std::vector<std::string> flags;
+                ReadTitleFlags(title_id, &flags);
+                SetTitleFlags(out, title_id, std::move(flags));
+            }
+        }
+    }
+}
+
+void Utils::RefreshFlagIndex() {
+    /* Scan outside the lock, so lookups aren't held up by the SD card. */
+    FlagIndex index;
+    BuildFlagIndex(&index);
+    
+    std::scoped_lock<HosMutex> lk(g_flag_index_lock);
+    std::swap(g_flag_index, index);
+}
+
+void Utils::RefreshTitleFlags(u64 tid) {
+    /* Only rescan the title's own flags and the global flags, rather than all of /atmosphere/titles. */
+    std::vector<std::string> global_flags;
+    std::vector<std::string> title_flags;
+    AddFlagsInDirectory("/atmosphere/flags", &global_flags);
+    ReadTitleFlags(tid, &title_flags);
+    
+    std::scoped_lock<HosMutex> lk(g_flag_index_lock);
+    std::swap(g_flag_index.global_flags, global_flags);
+    SetTitleFlags(&g_flag_index, tid, std::move(title_flags));
+}
+
 void Utils::RefreshConfiguration() {
     FsFile config_file;
     if (R_FAILED(fsFsOpenFile(&g_sd_filesystem, "/atmosphere/loader.ini", FS_OPEN_READ, &config_file))) {
@@ -58,6 +58,7 @@ class Utils {
         static Result OpenRomFSDir(FsFileSystem *fs, u64 title_id, const char *path, FsDir *out);
         
         static Result SaveSdFileForAtmosphere(u64 title_id, const char *fn, void *data, size_t size);
+        static Result DeleteSdFileForAtmosphere(u64 title_id, const char *fn);
         
         static bool HasSdRomfsContent(u64 title_id);
         
@@ -73,6 +74,9 @@ class Utils {
         
         static bool HasSdMitMFlag(u64 tid);
         static bool HasSdDisableMitMFlag(u64 tid);
+        /* Flags are indexed when the SD card is initialized; a title's flags are rescanned when it launches. */
+        static void RefreshFlagIndex();
+        static void RefreshTitleFlags(u64 tid);
         
         
         static bool IsHidAvailable();
@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2018 Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <switch.h>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <sys/stat.h>
+#include "dmnt_cheat_file.hpp"
+
+/* Cheats are only loaded under the cheat manager's lock, so one buffer will do. */
+static char g_cheat_file_buffer[0x4000];
+
+static inline u32 GetHexValue(int c) {
+    if ('0' <= c && c <= '9') {
+        return c - '0';
+    } else if ('a' <= c && c <= 'f') {
+        return c - 'a' + 0xA;
+    } else {
+        return c - 'A' + 0xA;
+    }
+}
+
+bool DmntCheatFile::ParseCheats(FILE *f, CheatEntry *out_cheats, size_t max_cheats, size_t *out_count, bool *out_has_master_code) {
+    constexpr size_t MaxOpcodes = sizeof(out_cheats->definition.opcodes) / sizeof(out_cheats->definition.opcodes[0]);
+    
+    size_t num_cheats = 0;
+    bool has_master_code = false;
+    CheatEntry *cur_cheat = nullptr;
+    
+    /* Entries without opcodes (e.g. section headers) would look like free slots, so a cheat only takes one once it has an opcode. */
+    char pending_name[sizeof(out_cheats->definition.readable_name)];
+    bool has_pending_name = false;
+    bool pending_is_master_code = false;
+    
+    int c = getc(f);
+    while (c != EOF) {
+        if (isspace(c)) {
+            c = getc(f);
+        } else if (c == '[' || c == '{') {
+            /* A name starts a new cheat: [Cheat] or {Master Code}. */
+            pending_is_master_code = c == '{';
+            const int end = pending_is_master_code ? '}' : ']';
+            
+            std::memset(pending_name, 0, sizeof(pending_name));
+            size_t name_len = 0;
+            while ((c = getc(f)) != end) {
+                if (c == EOF || c == '\n') {
+                    return false;
+                }
+                /* Overlong names are truncated. */
+                if (name_len < sizeof(pending_name) - 1) {
+                    pending_name[name_len++] = c;
+                }
+            }
+            c = getc(f);
+            
+            has_pending_name = true;
+            cur_cheat = nullptr;
+        } else if (isxdigit(c)) {
+            /* Opcodes are eight hex digits each. */
+            u32 opcode = 0;
+            size_t num_digits = 0;
+            while (c != EOF && isxdigit(c)) {
+                if (++num_digits > 8) {
+                    return false;
+                }
+                opcode = (opcode << 4) | GetHexValue(c);
+                c = getc(f);
+            }
+            
+            if (num_digits != 8 || (c != EOF && !isspace(c))) {
+                return false;
+            }
+            
+            /* The first opcode after a name creates its cheat. */
+            if (has_pending_name) {
+                if (num_cheats == max_cheats || (pending_is_master_code && has_master_code)) {
+                    return false;
+                }
+                
+                cur_cheat = &out_cheats[num_cheats++];
+                std::memset(cur_cheat, 0, sizeof(*cur_cheat));
+                cur_cheat->enabled = true;
+                std::memcpy(cur_cheat->definition.readable_name, pending_name, sizeof(pending_name));
+                has_pending_name = false;
+                
+                /* The master code has to run before anything else. */
+                if (pending_is_master_code) {
+                    std::rotate(out_cheats, cur_cheat, cur_cheat + 1);
+                    cur_cheat = &out_cheats[0];
+                    has_master_code = true;
+                }
+            }
+            
+            if (cur_cheat == nullptr || cur_cheat->definition.num_opcodes == MaxOpcodes) {
+                return false;
+            }
+            cur_cheat->definition.opcodes[cur_cheat->definition.num_opcodes++] = opcode;
+        } else {
+            return false;
+        }
+    }
+    
+    for (size_t i = 0; i < num_cheats; i++) {
+        out_cheats[i].cheat_id = i;
+    }
+    
+    *out_count = num_cheats;
+    *out_has_master_code = has_master_code;
+    return true;
+}
+
+bool DmntCheatFile::LoadCache(const char *path, const CheatCacheHeader *expected, CheatEntry *out_cheats, size_t max_cheats, size_t *out_count, bool *out_has_master_code) {
+    constexpr size_t MaxOpcodes = sizeof(out_cheats->definition.opcodes) / sizeof(out_cheats->definition.opcodes[0]);
+    
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return false;
+    }
+    ON_SCOPE_EXIT { fclose(f); };
+    setvbuf(f, NULL, _IONBF, 0);
+    
+    /* Only trust a cache made from this exact text, for this exact build. */
+    CheatCacheHeader header;
+    if (fread(&header, sizeof(header), 1, f) != 1) {
+        return false;
+    }
+    if (header.magic != expected->magic || header.version != expected->version || std::memcmp(header.build_id, expected->build_id, sizeof(header.build_id)) != 0) {
+        return false;
+    }
+    if (header.text_size != expected->text_size || header.text_mtime != expected->text_mtime || header.num_cheats > max_cheats) {
+        return false;
+    }
+    if (header.has_master_code > 1 || (header.has_master_code && header.num_cheats == 0)) {
+        return false;
+    }
+    
+    /* The cheats are stored exactly as we use them, so read them straight in. */
+    if (fread(out_cheats, sizeof(*out_cheats), header.num_cheats, f) != header.num_cheats) {
+        return false;
+    }
+    for (size_t i = 0; i < header.num_cheats; i++) {
+        if (out_cheats[i].cheat_id != i || out_cheats[i].definition.num_opcodes == 0 || out_cheats[i].definition.num_opcodes > MaxOpcodes) {
+            return false;
+        }
+        out_cheats[i].definition.readable_name[sizeof(out_cheats[i].definition.readable_name) - 1] = '\x00';
+    }
+    
+    *out_count = header.num_cheats;
+    *out_has_master_code = header.has_master_code;
+    return true;
+}
+
+void DmntCheatFile::SaveCache(const char *path, const CheatCacheHeader *header, const CheatEntry *cheats) {
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        return;
+    }
+    setvbuf(f, NULL, _IONBF, 0);
+    
+    bool written = fwrite(header, sizeof(*header), 1, f) == 1;
+    written &= fwrite(cheats, sizeof(*cheats), header->num_cheats, f) == header->num_cheats;
+    fclose(f);
+    
+    /* Don't leave a partial cache behind. */
+    if (!written) {
+        remove(path);
+    }
+}
+
+bool DmntCheatFile::LoadCheats(CheatEntry *out_cheats, size_t max_cheats, size_t *out_count, bool *out_has_master_code, u64 title_id, const u8 *build_id) {
+    /* Cheat files are named by the first half of the main module's build id. */
+    char build_id_str[0x11];
+    for (size_t i = 0; i < 8; i++) {
+        snprintf(build_id_str + i * 2, 3, "%02X", build_id[i]);
+    }
+    
+    char text_path[FS_MAX_PATH];
+    char cache_path[FS_MAX_PATH];
+    snprintf(text_path, sizeof(text_path), "sdmc:/atmosphere/titles/%016lx/cheats/%s.txt", title_id, build_id_str);
+    snprintf(cache_path, sizeof(cache_path), "sdmc:/atmosphere/titles/%016lx/cheats/%s.cache", title_id, build_id_str);
+    
+    struct stat st;
+    if (stat(text_path, &st) != 0) {
+        return false;
+    }
+    
+    CheatCacheHeader header = {0};
+    header.magic = CHEAT_CACHE_MAGIC;
+    header.version = CHEAT_CACHE_VERSION;
+    std::memcpy(header.build_id, build_id, sizeof(header.build_id));
+    header.text_size = st.st_size;
+    header.text_mtime = st.st_mtime;
+    
+    /* Slots past the cheats we load must read as free. */
+    std::memset(out_cheats, 0, sizeof(*out_cheats) * max_cheats);
+    
+    /* Without a modification time, an edit that kept the size would go unnoticed, so always parse. */
+    const bool use_cache = header.text_mtime != 0;
+    if (use_cache && LoadCache(cache_path, &header, out_cheats, max_cheats, out_count, out_has_master_code)) {
+        return true;
+    }
+    
+    /* A cache that failed validation may have been partly read in, so start over. */
+    std::memset(out_cheats, 0, sizeof(*out_cheats) * max_cheats);
+    
+    FILE *f = fopen(text_path, "r");
+    if (f == NULL) {
+        return false;
+    }
+    setvbuf(f, g_cheat_file_buffer, _IOFBF, sizeof(g_cheat_file_buffer));
+    
+    const bool parsed = ParseCheats(f, out_cheats, max_cheats, out_count, out_has_master_code);
+    fclose(f);
+    if (!parsed) {
+        return false;
+    }
+    
+    if (use_cache) {
+        header.num_cheats = *out_count;
+        header.has_master_code = *out_has_master_code;
+        SaveCache(cache_path, &header, out_cheats);
+    }
+    return true;
+}
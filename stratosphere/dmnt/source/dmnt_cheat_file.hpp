@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2018 Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <switch.h>
+#include <stratosphere.hpp>
+#include <cstdio>
+
+#include "dmnt_cheat_types.hpp"
+
+#define CHEAT_CACHE_MAGIC 0x54484344 /* "DCHT" */
+#define CHEAT_CACHE_VERSION 2
+
+/* Parsed cheats are cached next to the text, so later launches needn't parse it again. */
+struct CheatCacheHeader {
+    u32 magic;
+    u32 version;
+    u8 build_id[0x20];
+    /* The text file the cheats were parsed from. */
+    u64 text_size;
+    u64 text_mtime;
+    u32 num_cheats;
+    u32 has_master_code;
+};
+
+class DmntCheatFile {
+    private:
+        static bool ParseCheats(FILE *f, CheatEntry *out_cheats, size_t max_cheats, size_t *out_count, bool *out_has_master_code);
+        static bool LoadCache(const char *path, const CheatCacheHeader *expected, CheatEntry *out_cheats, size_t max_cheats, size_t *out_count, bool *out_has_master_code);
+        static void SaveCache(const char *path, const CheatCacheHeader *header, const CheatEntry *cheats);
+    public:
+        /* Loads /atmosphere/titles/<tid>/cheats/<build id>.txt, numbering cheats by their index. */
+        /* A master code, in braces rather than brackets, always comes first. It's up to the caller to keep it enabled. */
+        static bool LoadCheats(CheatEntry *out_cheats, size_t max_cheats, size_t *out_count, bool *out_has_master_code, u64 title_id, const u8 *build_id);
+};
@@ -15,29 +15,113 @@
  */
  
 #include <switch.h>
+#include <algorithm>
+#include <cstring>
 #include "dmnt_cheat_manager.hpp"
 #include "dmnt_cheat_vm.hpp"
+#include "dmnt_cheat_file.hpp"
 #include "pm_shim.h"
 
 static HosMutex g_cheat_lock;
-static HosThread g_detect_thread, g_vm_thread;
+static HosThread g_detect_thread, g_vm_thread, g_debug_events_thread;
 
 static IEvent *g_cheat_process_event;
 static DmntCheatVm *g_cheat_vm;
 
 static CheatProcessMetadata g_cheat_process_metadata = {0};
 static Handle g_cheat_process_debug_hnd = 0;
+/* Set once the process has been checked, and cleared when we see it exit. */
+static bool g_cheat_process_verified = false;
+
+static CheatEntry g_cheat_entries[DmntCheatManager::MaxCheatCount];
+/* If set, the first cheat is the master code, which stays enabled. */
+static bool g_has_master_code = false;
+static u64 g_vm_tick_interval = 1000000000ul / DmntCheatManager::DefaultVmTickRate;
+
+/* Signaled when the VM thread should look at the cheats again, rather than waiting out its tick. */
+static HosSignal g_vm_wakeup_signal;
+/* Signaled when a process is attached, so its debug events get handled. */
+static HosSignal g_debug_events_signal;
+
+enum DmntDebugEventType : u32 {
+    DmntDebugEventType_AttachProcess = 0,
+    DmntDebugEventType_AttachThread = 1,
+    DmntDebugEventType_ExitProcess = 2,
+    DmntDebugEventType_ExitThread = 3,
+    DmntDebugEventType_Exception = 4,
+};
+
+struct DmntDebugEventInfo {
+    u32 type;
+    u32 flags;
+    u64 thread_id;
+    u64 info[6];
+};
+
+/* While the VM executes, its memory accesses are batched: writes are combined and */
+/* issued when execution ends, and reads are served from whole pages read once. */
+static constexpr size_t VmMemoryPageSize = 0x1000;
+static constexpr size_t VmMaxPendingWrites = 0x40;
+static constexpr size_t VmMaxPendingWriteSize = 0x100;
+static constexpr size_t VmNumCachedPages = 4;
+
+struct VmPendingWrite {
+    u64 address;
+    size_t size;
+    u8 data[VmMaxPendingWriteSize];
+};
+
+struct VmCachedPage {
+    u64 address;
+    bool is_valid;
+    u8 data[VmMemoryPageSize];
+};
+
+static bool g_vm_batch_active = false;
+static VmPendingWrite g_vm_pending_writes[VmMaxPendingWrites];
+static size_t g_vm_num_pending_writes = 0;
+static VmCachedPage g_vm_cached_pages[VmNumCachedPages];
+static size_t g_vm_next_cached_page = 0;
+
+static inline u64 GetVmMemoryPage(u64 address) {
+    return address & ~(VmMemoryPageSize - 1);
+}
+
+static inline bool IsWithinVmMemoryPage(u64 address, size_t size) {
+    return size != 0 && GetVmMemoryPage(address) == GetVmMemoryPage(address + size - 1);
+}
+
+static inline bool RangesOverlap(u64 a, size_t a_size, u64 b, size_t b_size) {
+    return a < b + b_size && b < a + a_size;
+}
+
+static inline bool RangesTouch(u64 a, size_t a_size, u64 b, size_t b_size) {
+    return a <= b + b_size && b <= a + a_size;
+}
 
 void DmntCheatManager::CloseActiveCheatProcess() {
     if (g_cheat_process_debug_hnd != 0) {
         svcCloseHandle(g_cheat_process_debug_hnd);
         g_cheat_process_debug_hnd = 0;
+        g_cheat_process_verified = false;
         g_cheat_process_metadata = (CheatProcessMetadata){0};
+        
+        /* Cheats belong to the process, so they go with it. */
+        ResetCheats();
+        
+        /* Stop waiting on the closed handle. */
+        svcCancelSynchronization(g_debug_events_thread.GetHandle());
+        
         g_cheat_process_event->Signal();
     }
 }
 
 bool DmntCheatManager::HasActiveCheatProcess() {
+    /* Once the process checks out, trust it until we see it exit. */
+    if (g_cheat_process_verified) {
+        return true;
+    }
+    
     u64 tmp;
     bool has_cheat_process = g_cheat_process_debug_hnd != 0;
     
@@ -57,42 +141,197 @@ bool DmntCheatManager::HasActiveCheatProcess() {
         CloseActiveCheatProcess();
     }
     
+    g_cheat_process_verified = has_cheat_process;
     return has_cheat_process;
 }
 
 void DmntCheatManager::ContinueCheatProcess() {
     if (HasActiveCheatProcess()) {
-        /* Loop getting debug events. */
-        u8 tmp;
-        while (R_SUCCEEDED(svcGetDebugEvent(&tmp, g_cheat_process_debug_hnd))) {
-            /* ... */
+        /* Loop getting debug events, watching for the process exiting. */
+        DmntDebugEventInfo d;
+        bool has_event = false, exited = false;
+        while (R_SUCCEEDED(svcGetDebugEvent(reinterpret_cast<u8 *>(&d), g_cheat_process_debug_hnd))) {
+            has_event = true;
+            if (d.type == DmntDebugEventType_ExitProcess) {
+                exited = true;
+            }
         }
         
-        /* Continue the process. */
-        if (kernelAbove300()) {
-            svcContinueDebugEvent(g_cheat_process_debug_hnd, 5, nullptr, 0);
-        } else {
-            svcLegacyContinueDebugEvent(g_cheat_process_debug_hnd, 5, 0);
+        if (exited) {
+            CloseActiveCheatProcess();
+            return;
         }
+        
+        /* Continue the process, if anything stopped it. */
+        if (has_event) {
+            if (kernelAbove300()) {
+                svcContinueDebugEvent(g_cheat_process_debug_hnd, 5, nullptr, 0);
+            } else {
+                svcLegacyContinueDebugEvent(g_cheat_process_debug_hnd, 5, 0);
+            }
+        }
+    }
+}
+
+void DmntCheatManager::WakeVmThread() {
+    g_vm_wakeup_signal.Signal();
+}
+
+void DmntCheatManager::ResetCheats() {
+    std::memset(g_cheat_entries, 0, sizeof(g_cheat_entries));
+    g_has_master_code = false;
+    g_vm_tick_interval = 1000000000ul / DefaultVmTickRate;
+    ReloadCheatVmProgram();
+}
+
+bool DmntCheatManager::ReloadCheatVmProgram() {
+    /* Removed cheats are zeroed, so LoadProgram skips them along with disabled ones. */
+    const bool loaded = g_cheat_vm->LoadProgram(g_cheat_entries, MaxCheatCount);
+    WakeVmThread();
+    return loaded;
+}
+
+void DmntCheatManager::FlushVmPendingWrites() {
+    /* Pending writes never overlap, so the order we issue them in doesn't matter. */
+    for (size_t i = 0; i < g_vm_num_pending_writes; i++) {
+        svcWriteDebugProcessMemory(g_cheat_process_debug_hnd, g_vm_pending_writes[i].data, g_vm_pending_writes[i].address, g_vm_pending_writes[i].size);
     }
+    g_vm_num_pending_writes = 0;
+}
+
+void DmntCheatManager::BeginVmMemoryBatch() {
+    g_vm_batch_active = true;
+    g_vm_num_pending_writes = 0;
+    for (size_t i = 0; i < VmNumCachedPages; i++) {
+        g_vm_cached_pages[i].is_valid = false;
+    }
+}
+
+void DmntCheatManager::EndVmMemoryBatch() {
+    FlushVmPendingWrites();
+    g_vm_batch_active = false;
+}
+
+Result DmntCheatManager::ReadVmMemoryBatched(u64 proc_addr, void *out_data, size_t size) {
+    /* Reads spanning pages are rare, so just make sure they see our writes. */
+    if (!IsWithinVmMemoryPage(proc_addr, size)) {
+        FlushVmPendingWrites();
+        return svcReadDebugProcessMemory(out_data, g_cheat_process_debug_hnd, proc_addr, size);
+    }
+    
+    const u64 page_address = GetVmMemoryPage(proc_addr);
+    VmCachedPage *page = nullptr;
+    for (size_t i = 0; i < VmNumCachedPages; i++) {
+        if (g_vm_cached_pages[i].is_valid && g_vm_cached_pages[i].address == page_address) {
+            page = &g_vm_cached_pages[i];
+            break;
+        }
+    }
+    
+    if (page == nullptr) {
+        /* Read the whole page, and apply any writes we haven't issued yet. */
+        page = &g_vm_cached_pages[g_vm_next_cached_page];
+        g_vm_next_cached_page = (g_vm_next_cached_page + 1) % VmNumCachedPages;
+        
+        page->is_valid = false;
+        if (R_FAILED(svcReadDebugProcessMemory(page->data, g_cheat_process_debug_hnd, page_address, VmMemoryPageSize))) {
+            FlushVmPendingWrites();
+            return svcReadDebugProcessMemory(out_data, g_cheat_process_debug_hnd, proc_addr, size);
+        }
+        for (size_t i = 0; i < g_vm_num_pending_writes; i++) {
+            const VmPendingWrite *write = &g_vm_pending_writes[i];
+            if (GetVmMemoryPage(write->address) == page_address) {
+                std::memcpy(page->data + (write->address - page_address), write->data, write->size);
+            }
+        }
+        page->address = page_address;
+        page->is_valid = true;
+    }
+    
+    std::memcpy(out_data, page->data + (proc_addr - page_address), size);
+    return 0;
+}
+
+Result DmntCheatManager::WriteVmMemoryBatched(u64 proc_addr, const void *data, size_t size) {
+    /* Keep cached pages up to date. */
+    for (size_t i = 0; i < VmNumCachedPages; i++) {
+        VmCachedPage *page = &g_vm_cached_pages[i];
+        if (page->is_valid && RangesOverlap(page->address, VmMemoryPageSize, proc_addr, size)) {
+            const u64 start = std::max(page->address, proc_addr);
+            const u64 end = std::min(page->address + VmMemoryPageSize, proc_addr + size);
+            std::memcpy(page->data + (start - page->address), reinterpret_cast<const u8 *>(data) + (start - proc_addr), end - start);
+        }
+    }
+    
+    /* Merge into a pending write we overlap or touch, as long as it stays within one page. */
+    /* Pages are mapped as a whole, so a merged write succeeds wherever its parts would have. */
+    VmPendingWrite *merge_target = nullptr;
+    size_t num_overlapping = 0;
+    for (size_t i = 0; i < g_vm_num_pending_writes; i++) {
+        VmPendingWrite *write = &g_vm_pending_writes[i];
+        if (RangesTouch(write->address, write->size, proc_addr, size)) {
+            const u64 start = std::min(write->address, proc_addr);
+            const u64 end = std::max(write->address + write->size, proc_addr + size);
+            if (merge_target == nullptr && end - start <= VmMaxPendingWriteSize && IsWithinVmMemoryPage(start, end - start)) {
+                merge_target = write;
+            }
+            if (RangesOverlap(write->address, write->size, proc_addr, size)) {
+                num_overlapping++;
+            }
+        }
+    }
+    
+    if (merge_target != nullptr && num_overlapping <= (RangesOverlap(merge_target->address, merge_target->size, proc_addr, size) ? 1 : 0)) {
+        const u64 start = std::min(merge_target->address, proc_addr);
+        const u64 end = std::max(merge_target->address + merge_target->size, proc_addr + size);
+        if (start < merge_target->address) {
+            std::memmove(merge_target->data + (merge_target->address - start), merge_target->data, merge_target->size);
+        }
+        std::memcpy(merge_target->data + (proc_addr - start), data, size);
+        merge_target->address = start;
+        merge_target->size = end - start;
+        return 0;
+    }
+    
+    /* Otherwise, make sure earlier writes we overlap land first. */
+    if (num_overlapping > 0 || g_vm_num_pending_writes == VmMaxPendingWrites) {
+        FlushVmPendingWrites();
+    }
+    
+    if (size > VmMaxPendingWriteSize || !IsWithinVmMemoryPage(proc_addr, size)) {
+        return svcWriteDebugProcessMemory(g_cheat_process_debug_hnd, data, proc_addr, size);
+    }
+    
+    VmPendingWrite *write = &g_vm_pending_writes[g_vm_num_pending_writes++];
+    write->address = proc_addr;
+    write->size = size;
+    std::memcpy(write->data, data, size);
+    return 0;
 }
 
 Result DmntCheatManager::ReadCheatProcessMemoryForVm(u64 proc_addr, void *out_data, size_t size) {
+    /* The process was checked when the batch began, and can't go away while we hold the lock. */
+    if (g_vm_batch_active) {
+        return ReadVmMemoryBatched(proc_addr, out_data, size);
+    }
+    
     if (HasActiveCheatProcess()) {
         return svcReadDebugProcessMemory(out_data, g_cheat_process_debug_hnd, proc_addr, size);
     }
     
-    /* TODO: Return value... */
-    return 0x20F;
+    return DmntCheatResult_CheatNotAttached;
 }
 
 Result DmntCheatManager::WriteCheatProcessMemoryForVm(u64 proc_addr, const void *data, size_t size) {
+    if (g_vm_batch_active) {
+        return WriteVmMemoryBatched(proc_addr, data, size);
+    }
+    
     if (HasActiveCheatProcess()) {
         return svcWriteDebugProcessMemory(g_cheat_process_debug_hnd, data, proc_addr, size);
     }
     
-    /* TODO: Return value... */
-    return 0x20F;
+    return DmntCheatResult_CheatNotAttached;
 }
 
 Result DmntCheatManager::ReadCheatProcessMemory(u64 proc_addr, void *out_data, size_t size) {
@@ -107,6 +346,55 @@ Result DmntCheatManager::WriteCheatProcessMemory(u64 proc_addr, const void *data
     return WriteCheatProcessMemoryForVm(proc_addr, data, size);
 }
 
+Result DmntCheatManager::QueryCheatProcessMemory(MemoryInfo *mapping, u64 address) {
+    std::scoped_lock<HosMutex> lk(g_cheat_lock);
+    
+    if (HasActiveCheatProcess()) {
+        u32 tmp;
+        return svcQueryDebugProcessMemory(mapping, &tmp, g_cheat_process_debug_hnd, address);
+    }
+    
+    return DmntCheatResult_CheatNotAttached;
+}
+
+Result DmntCheatManager::GetCheatProcessMappingCount(u64 *out_count) {
+    u64 count = 0;
+    Result rc = GetCheatProcessMappings(nullptr, 0, &count, 0);
+    *out_count = count;
+    return rc;
+}
+
+Result DmntCheatManager::GetCheatProcessMappings(MemoryInfo *mappings, size_t max_count, u64 *out_count, u64 offset) {
+    std::scoped_lock<HosMutex> lk(g_cheat_lock);
+    
+    if (!HasActiveCheatProcess()) {
+        return DmntCheatResult_CheatNotAttached;
+    }
+    
+    /* Walk the address space, counting everything mapped, and copying out what was asked for. */
+    MemoryInfo mapping;
+    u64 address = 0, count = 0, total = 0;
+    do {
+        u32 tmp;
+        if (R_FAILED(svcQueryDebugProcessMemory(&mapping, &tmp, g_cheat_process_debug_hnd, address))) {
+            break;
+        }
+        
+        if (mapping.perm != Perm_None) {
+            if (total >= offset && count < max_count) {
+                mappings[count++] = mapping;
+            }
+            total++;
+        }
+        
+        address = mapping.addr + mapping.size;
+    } while (address != 0);
+    
+    /* With nowhere to copy to, give the number of mappings. */
+    *out_count = mappings != nullptr ? count : total;
+    return 0;
+}
+
 Handle DmntCheatManager::PrepareDebugNextApplication() {
     Result rc;
     Handle event_h;
@@ -183,7 +471,16 @@ void DmntCheatManager::OnNewApplicationLaunch() {
         memcpy(g_cheat_process_metadata.main_nso_build_id, proc_modules[1].build_id, sizeof(g_cheat_process_metadata.main_nso_build_id));
     }
     
-    /* TODO: Read cheats off the SD. */
+    /* Read cheats off the SD, before attaching makes the application wait on us. */
+    {
+        u64 title_id;
+        size_t num_cheats = 0;
+        if (R_FAILED(pminfoGetTitleId(&title_id, g_cheat_process_metadata.process_id)) ||
+            !DmntCheatFile::LoadCheats(g_cheat_entries, MaxCheatCount, &num_cheats, &g_has_master_code, title_id, g_cheat_process_metadata.main_nso_build_id)) {
+            std::memset(g_cheat_entries, 0, sizeof(g_cheat_entries));
+            g_has_master_code = false;
+        }
+    }
     
     /* Open a debug handle. */
     if (R_FAILED((rc = svcDebugActiveProcess(&g_cheat_process_debug_hnd, g_cheat_process_metadata.process_id)))) {
@@ -193,6 +490,18 @@ void DmntCheatManager::OnNewApplicationLaunch() {
     /* Continue debug events, etc. */
     ContinueCheatProcess();
     
+    /* Start running the cheats, or leave all but the master code off if together they're too large. */
+    if (!ReloadCheatVmProgram()) {
+        for (size_t i = g_has_master_code ? 1 : 0; i < MaxCheatCount; i++) {
+            g_cheat_entries[i].enabled = false;
+        }
+        ReloadCheatVmProgram();
+    }
+    
+    /* Handle further debug events as they arrive, and let the VM pick up the new process. */
+    g_debug_events_signal.Signal();
+    WakeVmThread();
+    
     /* Signal to our fans. */
     g_cheat_process_event->Signal();
 }
@@ -215,22 +524,59 @@ void DmntCheatManager::DetectThread(void *arg) {
  
 void DmntCheatManager::VmThread(void *arg) {
     while (true) {
+        /* Clear any wakeup before looking at the cheats, so that later changes still wake us. */
+        g_vm_wakeup_signal.Reset();
+        
+        u64 tick_interval = 0;
+        
         /* Execute Cheat VM. */
         {
             /* Acquire lock. */
             std::scoped_lock<HosMutex> lk(g_cheat_lock);
             
-            if (HasActiveCheatProcess()) {
-                /* Handle any pending debug events. */
-                ContinueCheatProcess();
+            if (HasActiveCheatProcess() && g_cheat_vm->GetProgramSize() != 0) {
+                BeginVmMemoryBatch();
+                g_cheat_vm->Execute(&g_cheat_process_metadata);
+                EndVmMemoryBatch();
                 
-                /* Execute VM. */
-                if (g_cheat_vm->GetProgramSize() != 0) {
-                    g_cheat_vm->Execute(&g_cheat_process_metadata);
+                tick_interval = g_vm_tick_interval;
+            }
+        }
+        
+        if (tick_interval != 0) {
+            g_vm_wakeup_signal.TimedWait(tick_interval);
+        } else {
+            /* Nothing to run, so sleep until cheats are enabled or a process is attached. */
+            g_vm_wakeup_signal.Wait();
+        }
+    }
+}
+
+void DmntCheatManager::DebugEventsThread(void *arg) {
+    while (true) {
+        /* Wait for a process to be attached. */
+        g_debug_events_signal.Wait();
+        g_debug_events_signal.Reset();
+        
+        while (true) {
+            Handle debug_hnd;
+            {
+                std::scoped_lock<HosMutex> lk(g_cheat_lock);
+                if (!HasActiveCheatProcess()) {
+                    break;
+                }
+                debug_hnd = g_cheat_process_debug_hnd;
+            }
+            
+            /* The debug handle is signaled whenever it has events for us. */
+            /* If the wait fails, the handle was closed under us, and we look again. */
+            if (R_SUCCEEDED(svcWaitSynchronizationSingle(debug_hnd, U64_MAX))) {
+                std::scoped_lock<HosMutex> lk(g_cheat_lock);
+                if (debug_hnd == g_cheat_process_debug_hnd) {
+                    ContinueCheatProcess();
                 }
             }
         }
-        svcSleepThread(0x5000000ul);
     }
 }
 
@@ -252,8 +598,146 @@ Result DmntCheatManager::GetCheatProcessMetadata(CheatProcessMetadata *out) {
         return 0;
     }
     
-    /* TODO: Decide on a set of return values... */
-    return 0x20F;
+    return DmntCheatResult_CheatNotAttached;
+}
+
+Result DmntCheatManager::GetCheatCount(u64 *out_count) {
+    std::scoped_lock<HosMutex> lk(g_cheat_lock);
+    
+    if (!HasActiveCheatProcess()) {
+        return DmntCheatResult_CheatNotAttached;
+    }
+    
+    *out_count = std::count_if(g_cheat_entries, g_cheat_entries + MaxCheatCount, [](const CheatEntry &cheat) { return cheat.definition.num_opcodes != 0; });
+    return 0;
+}
+
+Result DmntCheatManager::GetCheats(CheatEntry *cheats, size_t max_count, u64 *out_count, u64 offset) {
+    std::scoped_lock<HosMutex> lk(g_cheat_lock);
+    
+    if (!HasActiveCheatProcess()) {
+        return DmntCheatResult_CheatNotAttached;
+    }
+    
+    u64 count = 0, skipped = 0;
+    for (size_t i = 0; i < MaxCheatCount && count < max_count; i++) {
+        if (g_cheat_entries[i].definition.num_opcodes == 0) {
+            continue;
+        }
+        if (skipped++ < offset) {
+            continue;
+        }
+        cheats[count++] = g_cheat_entries[i];
+    }
+    
+    *out_count = count;
+    return 0;
+}
+
+Result DmntCheatManager::GetCheatById(CheatEntry *out_cheat, u32 cheat_id) {
+    std::scoped_lock<HosMutex> lk(g_cheat_lock);
+    
+    if (!HasActiveCheatProcess()) {
+        return DmntCheatResult_CheatNotAttached;
+    }
+    if (cheat_id >= MaxCheatCount || g_cheat_entries[cheat_id].definition.num_opcodes == 0) {
+        return DmntCheatResult_UnknownCheatId;
+    }
+    
+    *out_cheat = g_cheat_entries[cheat_id];
+    return 0;
+}
+
+Result DmntCheatManager::ToggleCheat(u32 cheat_id) {
+    std::scoped_lock<HosMutex> lk(g_cheat_lock);
+    
+    if (!HasActiveCheatProcess()) {
+        return DmntCheatResult_CheatNotAttached;
+    }
+    if (cheat_id >= MaxCheatCount || g_cheat_entries[cheat_id].definition.num_opcodes == 0) {
+        return DmntCheatResult_UnknownCheatId;
+    }
+    if (g_has_master_code && cheat_id == 0) {
+        return DmntCheatResult_CheatCannotBeDisabled;
+    }
+    
+    g_cheat_entries[cheat_id].enabled = !g_cheat_entries[cheat_id].enabled;
+    if (!ReloadCheatVmProgram()) {
+        /* The program would be too large, so put things back how they were. */
+        g_cheat_entries[cheat_id].enabled = !g_cheat_entries[cheat_id].enabled;
+        ReloadCheatVmProgram();
+        return DmntCheatResult_CheatProgramTooLarge;
+    }
+    
+    return 0;
+}
+
+Result DmntCheatManager::AddCheat(u32 *out_id, const CheatDefinition *definition, bool enabled) {
+    std::scoped_lock<HosMutex> lk(g_cheat_lock);
+    
+    if (!HasActiveCheatProcess()) {
+        return DmntCheatResult_CheatNotAttached;
+    }
+    
+    if (definition->num_opcodes == 0 || definition->num_opcodes > sizeof(definition->opcodes) / sizeof(definition->opcodes[0])) {
+        return DmntCheatResult_InvalidCheat;
+    }
+    
+    CheatEntry *entry = std::find_if(g_cheat_entries, g_cheat_entries + MaxCheatCount, [](const CheatEntry &cheat) { return cheat.definition.num_opcodes == 0; });
+    if (entry == g_cheat_entries + MaxCheatCount) {
+        return DmntCheatResult_OutOfCheats;
+    }
+    
+    entry->enabled = enabled;
+    entry->cheat_id = entry - g_cheat_entries;
+    entry->definition = *definition;
+    /* Make sure the name is terminated, whatever the client sent. */
+    entry->definition.readable_name[sizeof(entry->definition.readable_name) - 1] = '\x00';
+    
+    if (!ReloadCheatVmProgram()) {
+        std::memset(entry, 0, sizeof(*entry));
+        ReloadCheatVmProgram();
+        return DmntCheatResult_CheatProgramTooLarge;
+    }
+    
+    *out_id = entry->cheat_id;
+    return 0;
+}
+
+Result DmntCheatManager::RemoveCheat(u32 cheat_id) {
+    std::scoped_lock<HosMutex> lk(g_cheat_lock);
+    
+    if (!HasActiveCheatProcess()) {
+        return DmntCheatResult_CheatNotAttached;
+    }
+    if (cheat_id >= MaxCheatCount || g_cheat_entries[cheat_id].definition.num_opcodes == 0) {
+        return DmntCheatResult_UnknownCheatId;
+    }
+    
+    /* The master code can be removed outright, after which its slot is an ordinary one. */
+    if (cheat_id == 0) {
+        g_has_master_code = false;
+    }
+    
+    std::memset(&g_cheat_entries[cheat_id], 0, sizeof(g_cheat_entries[cheat_id]));
+    ReloadCheatVmProgram();
+    return 0;
+}
+
+Result DmntCheatManager::SetVmTickRate(u32 ticks_per_second) {
+    std::scoped_lock<HosMutex> lk(g_cheat_lock);
+    
+    if (!HasActiveCheatProcess()) {
+        return DmntCheatResult_CheatNotAttached;
+    }
+    if (ticks_per_second > MaxVmTickRate) {
+        return DmntCheatResult_InvalidVmTickRate;
+    }
+    
+    /* Zero goes back to the default rate. The rate is reset along with the cheats. */
+    g_vm_tick_interval = 1000000000ul / (ticks_per_second != 0 ? ticks_per_second : DefaultVmTickRate);
+    WakeVmThread();
+    return 0;
 }
 
 void DmntCheatManager::InitializeCheatManager() {
@@ -270,9 +754,12 @@ void DmntCheatManager::InitializeCheatManager() {
     if (R_FAILED(g_vm_thread.Initialize(&DmntCheatManager::VmThread, nullptr, 0x4000, 28))) {
         std::abort();
     }
+    if (R_FAILED(g_debug_events_thread.Initialize(&DmntCheatManager::DebugEventsThread, nullptr, 0x4000, 28))) {
+        std::abort();
+    }
     
     /* Start threads. */
-    if (R_FAILED(g_detect_thread.Start()) || R_FAILED(g_vm_thread.Start())) {
+    if (R_FAILED(g_detect_thread.Start()) || R_FAILED(g_vm_thread.Start()) || R_FAILED(g_debug_events_thread.Start())) {
         std::abort();
     }
 }
@@ -26,10 +26,26 @@ class DmntCheatManager {
         static void OnNewApplicationLaunch();
         static void DetectThread(void *arg);
         static void VmThread(void *arg);
+        static void DebugEventsThread(void *arg);
         
         static bool HasActiveCheatProcess();
         static void CloseActiveCheatProcess();
         static void ContinueCheatProcess();
+        
+        static void WakeVmThread();
+        static void ResetCheats();
+        static bool ReloadCheatVmProgram();
+        
+        static void BeginVmMemoryBatch();
+        static void EndVmMemoryBatch();
+        static void FlushVmPendingWrites();
+        static Result ReadVmMemoryBatched(u64 proc_addr, void *out_data, size_t size);
+        static Result WriteVmMemoryBatched(u64 proc_addr, const void *data, size_t size);
+    public:
+        static constexpr size_t MaxCheatCount = 0x80;
+        /* The VM runs at about 12Hz unless the current cheats ask for another rate. */
+        static constexpr u32 DefaultVmTickRate = 12;
+        static constexpr u32 MaxVmTickRate = 240;
     public:
         static bool GetHasActiveCheatProcess();
         static Handle GetCheatProcessEventHandle();
@@ -39,6 +55,17 @@ class DmntCheatManager {
         static Result WriteCheatProcessMemoryForVm(u64 proc_addr, const void *data, size_t size);
         static Result ReadCheatProcessMemory(u64 proc_addr, void *out_data, size_t size);
         static Result WriteCheatProcessMemory(u64 proc_addr, const void *data, size_t size);
+        static Result QueryCheatProcessMemory(MemoryInfo *mapping, u64 address);
+        static Result GetCheatProcessMappingCount(u64 *out_count);
+        static Result GetCheatProcessMappings(MemoryInfo *mappings, size_t max_count, u64 *out_count, u64 offset);
+        
+        static Result GetCheatCount(u64 *out_count);
+        static Result GetCheats(CheatEntry *cheats, size_t max_count, u64 *out_count, u64 offset);
+        static Result GetCheatById(CheatEntry *out_cheat, u32 cheat_id);
+        static Result ToggleCheat(u32 cheat_id);
+        static Result AddCheat(u32 *out_id, const CheatDefinition *definition, bool enabled);
+        static Result RemoveCheat(u32 cheat_id);
+        static Result SetVmTickRate(u32 ticks_per_second);
         
         static void InitializeCheatManager();
 };
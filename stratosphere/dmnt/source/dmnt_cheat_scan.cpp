@@ -0,0 +1,707 @@
+/*
+ * Copyright (c) 2018 Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <switch.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include "dmnt_cheat_scan.hpp"
+#include "dmnt_cheat_manager.hpp"
+
+/* Results can be far larger than our heap, so they live on the SD card. */
+/* Each scan reads the file the previous one wrote, and writes the other. */
+static const char * const ScanFilePaths[2] = {
+    "sdmc:/atmosphere/dmnt_scan_0.bin",
+    "sdmc:/atmosphere/dmnt_scan_1.bin",
+};
+
+static constexpr size_t ScanPageSize = 0x1000;
+static constexpr size_t ScanFileBufferSize = 0x4000;
+/* FAT32 can't hold larger files, so scans with more results than this fail instead. */
+static constexpr u64 MaxScanFileSize = 0xFFFFFFFFul;
+
+/* Results are grouped by page: this header, then the u16 offset of each result, then their values. */
+struct ScanPageHeader {
+    u64 address;
+    u32 count;
+    u32 reserved;
+};
+
+/* An unknown first scan instead stores each chunk of memory it read: this header, then the contents. */
+struct ScanChunkHeader {
+    u64 address;
+    u64 size;
+};
+
+struct ScanRegion {
+    u64 address;
+    u64 size;
+};
+
+struct ScanState {
+    bool is_active;
+    /* Whether the results are a copy of memory, rather than pages of results. */
+    bool is_snapshot;
+    u32 file_index;
+    u64 process_id;
+    DmntScanValueType value_type;
+    u64 result_count;
+};
+
+static HosMutex g_scan_lock;
+static ScanState g_scan_state = {0};
+
+/* Working memory for scans, which is only allocated while one holds the lock. */
+struct ScanBuffers {
+    u8 memory[DmntCheatScanner::ReadChunkSize];
+    u8 old_memory[DmntCheatScanner::ReadChunkSize];
+    u8 read_buffer[ScanFileBufferSize];
+    u8 write_buffer[ScanFileBufferSize];
+    u16 offsets[ScanPageSize];
+    alignas(u64) u8 values[ScanPageSize];
+    u64 window_address;
+    size_t window_size;
+};
+static_assert(DmntCheatScanner::ReadAheadSize <= DmntCheatScanner::ReadChunkSize, "Read ahead must fit in the scan memory!");
+
+static ScanBuffers *g_scan_buffers = nullptr;
+
+class ScopedScanBuffers {
+    public:
+        ScopedScanBuffers() {
+            g_scan_buffers = new (std::nothrow) ScanBuffers;
+        }
+        
+        ~ScopedScanBuffers() {
+            delete g_scan_buffers;
+            g_scan_buffers = nullptr;
+        }
+        
+        bool IsValid() const {
+            return g_scan_buffers != nullptr;
+        }
+};
+
+class ScanFileWriter {
+    private:
+        FILE *f;
+        size_t buffered = 0;
+        u64 total_size = 0;
+        Result rc = 0;
+    public:
+        ScanFileWriter(FILE *file) : f(file) { }
+        
+        void Flush() {
+            if (this->buffered != 0 && fwrite(g_scan_buffers->write_buffer, 1, this->buffered, this->f) != this->buffered) {
+                this->rc = DmntCheatResult_ScanFileError;
+            }
+            this->buffered = 0;
+        }
+        
+        void Write(const void *data, size_t size) {
+            if (R_FAILED(this->rc)) {
+                return;
+            }
+            if (size > MaxScanFileSize - this->total_size) {
+                this->rc = DmntCheatResult_ScanTooLarge;
+                return;
+            }
+            this->total_size += size;
+            
+            /* Large writes go straight to the file. */
+            if (size >= ScanFileBufferSize) {
+                this->Flush();
+                if (fwrite(data, 1, size, this->f) != size) {
+                    this->rc = DmntCheatResult_ScanFileError;
+                }
+                return;
+            }
+            
+            if (this->buffered + size > ScanFileBufferSize) {
+                this->Flush();
+            }
+            std::memcpy(g_scan_buffers->write_buffer + this->buffered, data, size);
+            this->buffered += size;
+        }
+        
+        Result GetResult() const {
+            return this->rc;
+        }
+};
+
+class ScanFileReader {
+    private:
+        FILE *f;
+        size_t offset = 0;
+        size_t buffered = 0;
+    public:
+        ScanFileReader(FILE *file) : f(file) { }
+        
+        bool Read(void *out, size_t size) {
+            u8 *dst = reinterpret_cast<u8 *>(out);
+            while (size > 0) {
+                if (this->offset == this->buffered) {
+                    /* Large reads go straight from the file. */
+                    if (size >= ScanFileBufferSize) {
+                        return fread(dst, 1, size, this->f) == size;
+                    }
+                    this->offset = 0;
+                    this->buffered = fread(g_scan_buffers->read_buffer, 1, ScanFileBufferSize, this->f);
+                    if (this->buffered == 0) {
+                        return false;
+                    }
+                }
+                
+                const size_t cur_size = std::min(size, this->buffered - this->offset);
+                std::memcpy(dst, g_scan_buffers->read_buffer + this->offset, cur_size);
+                this->offset += cur_size;
+                dst += cur_size;
+                size -= cur_size;
+            }
+            return true;
+        }
+        
+        bool Skip(size_t size) {
+            const size_t cur_size = std::min(size, this->buffered - this->offset);
+            this->offset += cur_size;
+            size -= cur_size;
+            return size == 0 || fseek(this->f, size, SEEK_CUR) == 0;
+        }
+};
+
+static inline size_t GetScanValueSize(DmntScanValueType value_type) {
+    switch (value_type) {
+        case DmntScanValueType_U8:
+            return sizeof(u8);
+        case DmntScanValueType_U16:
+            return sizeof(u16);
+        case DmntScanValueType_U32:
+        case DmntScanValueType_Float:
+            return sizeof(u32);
+        case DmntScanValueType_U64:
+        case DmntScanValueType_Double:
+            return sizeof(u64);
+        default:
+            return 0;
+    }
+}
+
+template<typename T>
+static inline T FromRawValue(u64 raw) {
+    T value;
+    std::memcpy(&value, &raw, sizeof(value));
+    return value;
+}
+
+template<typename T, DmntScanCondition Condition>
+static inline bool MatchesCondition(T cur, T old, T value, T max_value) {
+    if constexpr (Condition == DmntScanCondition_Equal) {
+        return cur == value;
+    } else if constexpr (Condition == DmntScanCondition_Range) {
+        return value <= cur && cur <= max_value;
+    } else if constexpr (Condition == DmntScanCondition_Unknown) {
+        return true;
+    } else if constexpr (Condition == DmntScanCondition_Changed) {
+        return std::memcmp(&cur, &old, sizeof(T)) != 0;
+    } else if constexpr (Condition == DmntScanCondition_Unchanged) {
+        return std::memcmp(&cur, &old, sizeof(T)) == 0;
+    } else if constexpr (Condition == DmntScanCondition_Increased) {
+        return cur > old;
+    } else {
+        return cur < old;
+    }
+}
+
+/* Calls f with a value of the scan's type and its condition as a constant, so that each kernel is specialized. */
+template<typename F>
+static u32 DispatchScan(DmntScanValueType value_type, DmntScanCondition condition, F f) {
+    auto dispatch_condition = [&](auto type_tag) -> u32 {
+        switch (condition) {
+            case DmntScanCondition_Equal:
+                return f(type_tag, std::integral_constant<DmntScanCondition, DmntScanCondition_Equal>{});
+            case DmntScanCondition_Range:
+                return f(type_tag, std::integral_constant<DmntScanCondition, DmntScanCondition_Range>{});
+            case DmntScanCondition_Unknown:
+                return f(type_tag, std::integral_constant<DmntScanCondition, DmntScanCondition_Unknown>{});
+            case DmntScanCondition_Changed:
+                return f(type_tag, std::integral_constant<DmntScanCondition, DmntScanCondition_Changed>{});
+            case DmntScanCondition_Unchanged:
+                return f(type_tag, std::integral_constant<DmntScanCondition, DmntScanCondition_Unchanged>{});
+            case DmntScanCondition_Increased:
+                return f(type_tag, std::integral_constant<DmntScanCondition, DmntScanCondition_Increased>{});
+            case DmntScanCondition_Decreased:
+                return f(type_tag, std::integral_constant<DmntScanCondition, DmntScanCondition_Decreased>{});
+            default:
+                return 0;
+        }
+    };
+    
+    switch (value_type) {
+        case DmntScanValueType_U8:
+            return dispatch_condition(u8());
+        case DmntScanValueType_U16:
+            return dispatch_condition(u16());
+        case DmntScanValueType_U32:
+            return dispatch_condition(u32());
+        case DmntScanValueType_U64:
+            return dispatch_condition(u64());
+        case DmntScanValueType_Float:
+            return dispatch_condition(float());
+        case DmntScanValueType_Double:
+            return dispatch_condition(double());
+        default:
+            return 0;
+    }
+}
+
+/* The kernels store every value and only advance past matches, so that they don't branch on memory contents. */
+template<typename T, DmntScanCondition Condition>
+static u32 ScanPage(const u8 *cur, const u8 *old, size_t size, T value, T max_value, u16 *out_offsets, T *out_values) {
+    u32 count = 0;
+    for (size_t ofs = 0; ofs + sizeof(T) <= size; ofs += sizeof(T)) {
+        T cur_value, old_value = T();
+        std::memcpy(&cur_value, cur + ofs, sizeof(T));
+        if (old != nullptr) {
+            std::memcpy(&old_value, old + ofs, sizeof(T));
+        }
+        out_offsets[count] = static_cast<u16>(ofs);
+        out_values[count] = cur_value;
+        count += MatchesCondition<T, Condition>(cur_value, old_value, value, max_value) ? 1 : 0;
+    }
+    return count;
+}
+
+/* Offsets and values may alias the outputs, as each result is read before it can be overwritten. */
+template<typename T, DmntScanCondition Condition>
+static u32 ScanPageResults(const u8 *cur, const u16 *offsets, const T *old_values, u32 num_results, T value, T max_value, u16 *out_offsets, T *out_values) {
+    u32 count = 0;
+    for (u32 i = 0; i < num_results; i++) {
+        const u16 ofs = offsets[i];
+        const T old_value = old_values[i];
+        T cur_value;
+        std::memcpy(&cur_value, cur + ofs, sizeof(T));
+        out_offsets[count] = ofs;
+        out_values[count] = cur_value;
+        count += MatchesCondition<T, Condition>(cur_value, old_value, value, max_value) ? 1 : 0;
+    }
+    return count;
+}
+
+static void WriteScanPage(ScanFileWriter *writer, u64 address, u32 count, size_t value_size) {
+    if (count != 0) {
+        const ScanPageHeader header = { address, count, 0 };
+        writer->Write(&header, sizeof(header));
+        writer->Write(g_scan_buffers->offsets, count * sizeof(g_scan_buffers->offsets[0]));
+        writer->Write(g_scan_buffers->values, count * value_size);
+    }
+}
+
+/* Scans a chunk of memory page by page, comparing against an old copy if there is one. */
+static u64 ScanChunk(ScanFileWriter *writer, u64 address, size_t size, const u8 *cur, const u8 *old, DmntScanValueType value_type, DmntScanCondition condition, u64 value, u64 max_value) {
+    const size_t value_size = GetScanValueSize(value_type);
+    
+    u64 num_results = 0;
+    for (size_t ofs = 0; ofs < size; ofs += ScanPageSize) {
+        const size_t page_size = std::min(ScanPageSize, size - ofs);
+        const u8 *old_page = old != nullptr ? old + ofs : nullptr;
+        const u32 count = DispatchScan(value_type, condition, [&](auto type_tag, auto condition_tag) -> u32 {
+            using T = decltype(type_tag);
+            return ScanPage<T, decltype(condition_tag)::value>(cur + ofs, old_page, page_size, FromRawValue<T>(value), FromRawValue<T>(max_value), g_scan_buffers->offsets, reinterpret_cast<T *>(g_scan_buffers->values));
+        });
+        WriteScanPage(writer, address + ofs, count, value_size);
+        num_results += count;
+    }
+    return num_results;
+}
+
+/* Finds a page of the process' memory, reading ahead when it isn't in what we read last. */
+static const u8 *ReadScanPage(u64 address) {
+    if (g_scan_buffers->window_address <= address && address + ScanPageSize <= g_scan_buffers->window_address + g_scan_buffers->window_size) {
+        return g_scan_buffers->memory + (address - g_scan_buffers->window_address);
+    }
+    
+    g_scan_buffers->window_size = 0;
+    if (R_SUCCEEDED(DmntCheatManager::ReadCheatProcessMemory(address, g_scan_buffers->memory, DmntCheatScanner::ReadAheadSize))) {
+        g_scan_buffers->window_size = DmntCheatScanner::ReadAheadSize;
+    } else if (R_SUCCEEDED(DmntCheatManager::ReadCheatProcessMemory(address, g_scan_buffers->memory, ScanPageSize))) {
+        /* We're near the end of a mapping, so settle for the page itself. */
+        g_scan_buffers->window_size = ScanPageSize;
+    } else {
+        return nullptr;
+    }
+    
+    g_scan_buffers->window_address = address;
+    return g_scan_buffers->memory;
+}
+
+static Result GetScanRegions(std::vector<ScanRegion> *out_regions, const CheatProcessMetadata *metadata) {
+    Result rc;
+    const MemoryRegionExtents *extents[] = { &metadata->main_nso_extents, &metadata->heap_extents, &metadata->alias_extents };
+    
+    for (const MemoryRegionExtents *extent : extents) {
+        const u64 end = extent->base + extent->size;
+        u64 address = extent->base;
+        while (address < end) {
+            MemoryInfo mapping;
+            if (R_FAILED((rc = DmntCheatManager::QueryCheatProcessMemory(&mapping, address)))) {
+                return rc;
+            }
+            
+            const u64 mapping_end = mapping.addr + mapping.size;
+            if (mapping_end <= address) {
+                break;
+            }
+            
+            if (mapping.type != MemType_Unmapped && mapping.type != MemType_Io && (mapping.perm & Perm_R)) {
+                out_regions->push_back({address, std::min(mapping_end, end) - address});
+            }
+            address = mapping_end;
+        }
+    }
+    
+    /* The regions may overlap, so make sure we only scan each address once. */
+    std::sort(out_regions->begin(), out_regions->end(), [](const ScanRegion &a, const ScanRegion &b) { return a.address < b.address; });
+    u64 scanned_end = 0;
+    for (auto &region : *out_regions) {
+        if (region.address < scanned_end) {
+            const u64 overlap = std::min(region.size, scanned_end - region.address);
+            region.address += overlap;
+            region.size -= overlap;
+        }
+        scanned_end = std::max(scanned_end, region.address + region.size);
+    }
+    
+    return 0;
+}
+
+static Result ScanRegions(ScanFileWriter *writer, u64 *out_count, const std::vector<ScanRegion> &regions, DmntScanValueType value_type, DmntScanCondition condition, u64 value, u64 max_value) {
+    const size_t value_size = GetScanValueSize(value_type);
+    
+    u64 num_results = 0;
+    for (const auto &region : regions) {
+        for (u64 ofs = 0; ofs < region.size; ofs += DmntCheatScanner::ReadChunkSize) {
+            const u64 address = region.address + ofs;
+            const size_t size = std::min(region.size - ofs, static_cast<u64>(DmntCheatScanner::ReadChunkSize));
+            if (R_FAILED(DmntCheatManager::ReadCheatProcessMemory(address, g_scan_buffers->memory, size))) {
+                /* The process may have unmapped memory since we looked, which is fine unless it's gone. */
+                if (!DmntCheatManager::GetHasActiveCheatProcess()) {
+                    return DmntCheatResult_CheatNotAttached;
+                }
+                continue;
+            }
+            
+            if (condition == DmntScanCondition_Unknown) {
+                const ScanChunkHeader header = { address, size };
+                writer->Write(&header, sizeof(header));
+                writer->Write(g_scan_buffers->memory, size);
+                num_results += size / value_size;
+            } else {
+                num_results += ScanChunk(writer, address, size, g_scan_buffers->memory, nullptr, value_type, condition, value, max_value);
+            }
+            
+            if (R_FAILED(writer->GetResult())) {
+                return writer->GetResult();
+            }
+        }
+    }
+    
+    *out_count = num_results;
+    return 0;
+}
+
+static Result ScanSnapshot(ScanFileReader *reader, ScanFileWriter *writer, u64 *out_count, DmntScanValueType value_type, DmntScanCondition condition, u64 value, u64 max_value) {
+    u64 num_results = 0;
+    ScanChunkHeader header;
+    while (reader->Read(&header, sizeof(header))) {
+        if (header.size > DmntCheatScanner::ReadChunkSize || !reader->Read(g_scan_buffers->old_memory, header.size)) {
+            return DmntCheatResult_ScanFileCorrupted;
+        }
+        
+        if (R_FAILED(DmntCheatManager::ReadCheatProcessMemory(header.address, g_scan_buffers->memory, header.size))) {
+            if (!DmntCheatManager::GetHasActiveCheatProcess()) {
+                return DmntCheatResult_CheatNotAttached;
+            }
+            continue;
+        }
+        
+        num_results += ScanChunk(writer, header.address, header.size, g_scan_buffers->memory, g_scan_buffers->old_memory, value_type, condition, value, max_value);
+        if (R_FAILED(writer->GetResult())) {
+            return writer->GetResult();
+        }
+    }
+    
+    *out_count = num_results;
+    return 0;
+}
+
+static Result ScanResults(ScanFileReader *reader, ScanFileWriter *writer, u64 *out_count, DmntScanValueType value_type, DmntScanCondition condition, u64 value, u64 max_value) {
+    const size_t value_size = GetScanValueSize(value_type);
+    g_scan_buffers->window_size = 0;
+    
+    u64 num_results = 0;
+    ScanPageHeader header;
+    while (reader->Read(&header, sizeof(header))) {
+        if (header.count > ScanPageSize / value_size || !reader->Read(g_scan_buffers->offsets, header.count * sizeof(g_scan_buffers->offsets[0])) || !reader->Read(g_scan_buffers->values, header.count * value_size)) {
+            return DmntCheatResult_ScanFileCorrupted;
+        }
+        
+        const u8 *cur = ReadScanPage(header.address);
+        if (cur == nullptr) {
+            if (!DmntCheatManager::GetHasActiveCheatProcess()) {
+                return DmntCheatResult_CheatNotAttached;
+            }
+            continue;
+        }
+        
+        const u32 count = DispatchScan(value_type, condition, [&](auto type_tag, auto condition_tag) -> u32 {
+            using T = decltype(type_tag);
+            T *values = reinterpret_cast<T *>(g_scan_buffers->values);
+            return ScanPageResults<T, decltype(condition_tag)::value>(cur, g_scan_buffers->offsets, values, header.count, FromRawValue<T>(value), FromRawValue<T>(max_value), g_scan_buffers->offsets, values);
+        });
+        WriteScanPage(writer, header.address, count, value_size);
+        num_results += count;
+        
+        if (R_FAILED(writer->GetResult())) {
+            return writer->GetResult();
+        }
+    }
+    
+    *out_count = num_results;
+    return 0;
+}
+
+void DmntCheatScanner::ClearScan() {
+    std::scoped_lock<HosMutex> lk(g_scan_lock);
+    
+    g_scan_state = (ScanState){0};
+    for (const char *path : ScanFilePaths) {
+        remove(path);
+    }
+}
+
+Result DmntCheatScanner::StartScan(u64 *out_count, DmntScanValueType value_type, DmntScanCondition condition, u64 value, u64 max_value) {
+    Result rc;
+    
+    if (GetScanValueSize(value_type) == 0 || condition > DmntScanCondition_Unknown) {
+        return DmntCheatResult_InvalidScan;
+    }
+    
+    CheatProcessMetadata metadata;
+    if (R_FAILED((rc = DmntCheatManager::GetCheatProcessMetadata(&metadata)))) {
+        return rc;
+    }
+    
+    std::vector<ScanRegion> regions;
+    if (R_FAILED((rc = GetScanRegions(&regions, &metadata)))) {
+        return rc;
+    }
+    
+    std::scoped_lock<HosMutex> lk(g_scan_lock);
+    
+    ScopedScanBuffers buffers;
+    if (!buffers.IsValid()) {
+        return DmntCheatResult_ScanOutOfMemory;
+    }
+    
+    /* Write whichever file doesn't hold the current results, so they survive a failed scan. */
+    const u32 file_index = g_scan_state.is_active ? g_scan_state.file_index ^ 1 : 0;
+    FILE *f_out = fopen(ScanFilePaths[file_index], "wb");
+    if (f_out == NULL) {
+        return DmntCheatResult_ScanFileError;
+    }
+    setvbuf(f_out, NULL, _IONBF, 0);
+    
+    u64 num_results = 0;
+    {
+        ON_SCOPE_EXIT { fclose(f_out); };
+        
+        ScanFileWriter writer(f_out);
+        rc = ScanRegions(&writer, &num_results, regions, value_type, condition, value, max_value);
+        writer.Flush();
+        if (R_SUCCEEDED(rc)) {
+            rc = writer.GetResult();
+        }
+    }
+    
+    if (R_FAILED(rc)) {
+        remove(ScanFilePaths[file_index]);
+        return rc;
+    }
+    
+    g_scan_state.is_active = true;
+    g_scan_state.is_snapshot = condition == DmntScanCondition_Unknown;
+    g_scan_state.file_index = file_index;
+    g_scan_state.process_id = metadata.process_id;
+    g_scan_state.value_type = value_type;
+    g_scan_state.result_count = num_results;
+    
+    *out_count = num_results;
+    return 0;
+}
+
+Result DmntCheatScanner::ContinueScan(u64 *out_count, DmntScanCondition condition, u64 value, u64 max_value) {
+    Result rc;
+    
+    if (condition == DmntScanCondition_Unknown || condition > DmntScanCondition_Decreased) {
+        return DmntCheatResult_InvalidScan;
+    }
+    
+    CheatProcessMetadata metadata;
+    if (R_FAILED((rc = DmntCheatManager::GetCheatProcessMetadata(&metadata)))) {
+        return rc;
+    }
+    
+    std::scoped_lock<HosMutex> lk(g_scan_lock);
+    
+    ScopedScanBuffers buffers;
+    if (!buffers.IsValid()) {
+        return DmntCheatResult_ScanOutOfMemory;
+    }
+    
+    /* Results from another process are meaningless. */
+    if (!g_scan_state.is_active || g_scan_state.process_id != metadata.process_id) {
+        return DmntCheatResult_ScanNotActive;
+    }
+    
+    const u32 file_index = g_scan_state.file_index ^ 1;
+    FILE *f_in = fopen(ScanFilePaths[g_scan_state.file_index], "rb");
+    if (f_in == NULL) {
+        return DmntCheatResult_ScanFileError;
+    }
+    ON_SCOPE_EXIT { fclose(f_in); };
+    setvbuf(f_in, NULL, _IONBF, 0);
+    
+    FILE *f_out = fopen(ScanFilePaths[file_index], "wb");
+    if (f_out == NULL) {
+        return DmntCheatResult_ScanFileError;
+    }
+    setvbuf(f_out, NULL, _IONBF, 0);
+    
+    u64 num_results = 0;
+    {
+        ON_SCOPE_EXIT { fclose(f_out); };
+        
+        ScanFileReader reader(f_in);
+        ScanFileWriter writer(f_out);
+        if (g_scan_state.is_snapshot) {
+            rc = ScanSnapshot(&reader, &writer, &num_results, g_scan_state.value_type, condition, value, max_value);
+        } else {
+            rc = ScanResults(&reader, &writer, &num_results, g_scan_state.value_type, condition, value, max_value);
+        }
+        writer.Flush();
+        if (R_SUCCEEDED(rc)) {
+            rc = writer.GetResult();
+        }
+    }
+    
+    if (R_FAILED(rc)) {
+        remove(ScanFilePaths[file_index]);
+        return rc;
+    }
+    
+    g_scan_state.is_snapshot = false;
+    g_scan_state.file_index = file_index;
+    g_scan_state.result_count = num_results;
+    
+    *out_count = num_results;
+    return 0;
+}
+
+Result DmntCheatScanner::GetResultCount(u64 *out_count) {
+    std::scoped_lock<HosMutex> lk(g_scan_lock);
+    
+    if (!g_scan_state.is_active) {
+        return DmntCheatResult_ScanNotActive;
+    }
+    
+    *out_count = g_scan_state.result_count;
+    return 0;
+}
+
+Result DmntCheatScanner::GetResults(DmntScanResult *results, size_t max_count, u64 *out_count, u64 offset) {
+    std::scoped_lock<HosMutex> lk(g_scan_lock);
+    
+    ScopedScanBuffers buffers;
+    if (!buffers.IsValid()) {
+        return DmntCheatResult_ScanOutOfMemory;
+    }
+    
+    if (!g_scan_state.is_active) {
+        return DmntCheatResult_ScanNotActive;
+    }
+    
+    FILE *f_in = fopen(ScanFilePaths[g_scan_state.file_index], "rb");
+    if (f_in == NULL) {
+        return DmntCheatResult_ScanFileError;
+    }
+    ON_SCOPE_EXIT { fclose(f_in); };
+    setvbuf(f_in, NULL, _IONBF, 0);
+    
+    const size_t value_size = GetScanValueSize(g_scan_state.value_type);
+    ScanFileReader reader(f_in);
+    size_t count = 0;
+    
+    if (g_scan_state.is_snapshot) {
+        /* Every aligned value in the snapshot is a result. */
+        ScanChunkHeader header;
+        while (count < max_count && reader.Read(&header, sizeof(header))) {
+            const u64 num_values = header.size / value_size;
+            if (offset >= num_values) {
+                offset -= num_values;
+                reader.Skip(header.size);
+                continue;
+            }
+            
+            reader.Skip(offset * value_size);
+            u64 i;
+            for (i = offset; i < num_values && count < max_count; i++) {
+                results[count].address = header.address + i * value_size;
+                results[count].value = 0;
+                reader.Read(&results[count].value, value_size);
+                count++;
+            }
+            reader.Skip(header.size - i * value_size);
+            offset = 0;
+        }
+    } else {
+        ScanPageHeader header;
+        while (count < max_count && reader.Read(&header, sizeof(header))) {
+            const size_t offsets_size = header.count * sizeof(g_scan_buffers->offsets[0]);
+            if (offset >= header.count) {
+                offset -= header.count;
+                reader.Skip(offsets_size + header.count * value_size);
+                continue;
+            }
+            
+            if (header.count > ScanPageSize / value_size || !reader.Read(g_scan_buffers->offsets, offsets_size) || !reader.Read(g_scan_buffers->values, header.count * value_size)) {
+                return DmntCheatResult_ScanFileCorrupted;
+            }
+            for (u64 i = offset; i < header.count && count < max_count; i++) {
+                results[count].address = header.address + g_scan_buffers->offsets[i];
+                results[count].value = 0;
+                std::memcpy(&results[count].value, g_scan_buffers->values + i * value_size, value_size);
+                count++;
+            }
+            offset = 0;
+        }
+    }
+    
+    *out_count = count;
+    return 0;
+}
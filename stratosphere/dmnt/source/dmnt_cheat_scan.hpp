@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2018 Atmosphère-NX
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+#include <switch.h>
+#include <stratosphere.hpp>
+
+#include "dmnt_cheat_types.hpp"
+
+class DmntCheatScanner {
+    public:
+        /* Process memory is read this much at a time. */
+        static constexpr size_t ReadChunkSize = 0x10000;
+        /* Narrowing scans read ahead this much around each page with results. */
+        static constexpr size_t ReadAheadSize = 0x10000;
+    public:
+        /* Scans the cheat process' main module, heap and alias regions, replacing any previous results. */
+        static Result StartScan(u64 *out_count, DmntScanValueType value_type, DmntScanCondition condition, u64 value, u64 max_value);
+        /* Keeps the previous results that still match. */
+        static Result ContinueScan(u64 *out_count, DmntScanCondition condition, u64 value, u64 max_value);
+        static Result GetResultCount(u64 *out_count);
+        static Result GetResults(DmntScanResult *results, size_t max_count, u64 *out_count, u64 offset);
+        static void ClearScan();
+};
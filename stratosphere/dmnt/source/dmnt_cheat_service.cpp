@@ -17,6 +17,7 @@
 #include <switch.h>
 #include "dmnt_cheat_service.hpp"
 #include "dmnt_cheat_manager.hpp"
+#include "dmnt_cheat_scan.hpp"
 
 void DmntCheatService::HasCheatProcess(Out<bool> out) {
     out.SetValue(DmntCheatManager::GetHasActiveCheatProcess());
@@ -32,54 +33,64 @@ Result DmntCheatService::GetCheatProcessMetadata(Out<CheatProcessMetadata> out_m
 
 
 Result DmntCheatService::GetCheatProcessMappingCount(Out<u64> out_count) {
-    /* TODO */
-    return 0xF601;
+    return DmntCheatManager::GetCheatProcessMappingCount(out_count.GetPointer());
 }
 
 Result DmntCheatService::GetCheatProcessMappings(OutBuffer<MemoryInfo> mappings, Out<u64> out_count, u64 offset) {
-    /* TODO */
-    return 0xF601;
+    return DmntCheatManager::GetCheatProcessMappings(mappings.buffer, mappings.num_elements, out_count.GetPointer(), offset);
 }
 
 Result DmntCheatService::ReadCheatProcessMemory(OutBuffer<u8> buffer, u64 address, u64 out_size) {
-    /* TODO */
-    return 0xF601;
+    if (out_size > buffer.num_elements) {
+        return DmntCheatResult_InvalidBuffer;
+    }
+    
+    return DmntCheatManager::ReadCheatProcessMemory(address, buffer.buffer, out_size);
 }
 
 Result DmntCheatService::WriteCheatProcessMemory(InBuffer<u8> buffer, u64 address, u64 in_size) {
-    /* TODO */
-    return 0xF601;
+    if (in_size > buffer.num_elements) {
+        return DmntCheatResult_InvalidBuffer;
+    }
+    
+    return DmntCheatManager::WriteCheatProcessMemory(address, buffer.buffer, in_size);
 }
 
 
 Result DmntCheatService::GetCheatCount(Out<u64> out_count) {
-    /* TODO */
-    return 0xF601;
+    return DmntCheatManager::GetCheatCount(out_count.GetPointer());
 }
 
 Result DmntCheatService::GetCheats(OutBuffer<CheatEntry> cheats, Out<u64> out_count, u64 offset) {
-    /* TODO */
-    return 0xF601;
+    return DmntCheatManager::GetCheats(cheats.buffer, cheats.num_elements, out_count.GetPointer(), offset);
 }
 
 Result DmntCheatService::GetCheatById(OutBuffer<CheatEntry> cheat, u32 cheat_id) {
-    /* TODO */
-    return 0xF601;
+    if (cheat.num_elements < 1) {
+        return DmntCheatResult_InvalidBuffer;
+    }
+    
+    return DmntCheatManager::GetCheatById(cheat.buffer, cheat_id);
 }
 
 Result DmntCheatService::ToggleCheat(u32 cheat_id) {
-    /* TODO */
-    return 0xF601;
+    return DmntCheatManager::ToggleCheat(cheat_id);
 }
 
 Result DmntCheatService::AddCheat(InBuffer<CheatDefinition> cheat, Out<u32> out_cheat_id, bool enabled) {
-    /* TODO */
-    return 0xF601;
+    if (cheat.num_elements < 1) {
+        return DmntCheatResult_InvalidBuffer;
+    }
+    
+    return DmntCheatManager::AddCheat(out_cheat_id.GetPointer(), cheat.buffer, enabled);
 }
 
 Result DmntCheatService::RemoveCheat(u32 cheat_id) {
-    /* TODO */
-    return 0xF601;
+    return DmntCheatManager::RemoveCheat(cheat_id);
+}
+
+Result DmntCheatService::SetCheatVmTickRate(u32 ticks_per_second) {
+    return DmntCheatManager::SetVmTickRate(ticks_per_second);
 }
 
 
@@ -97,3 +108,24 @@ Result DmntCheatService::ToggleAddressFrozen(uintptr_t address) {
     /* TODO */
     return 0xF601;
 }
+
+
+Result DmntCheatService::StartMemoryScan(Out<u64> out_count, u32 value_type, u32 condition, u64 value, u64 max_value) {
+    return DmntCheatScanner::StartScan(out_count.GetPointer(), static_cast<DmntScanValueType>(value_type), static_cast<DmntScanCondition>(condition), value, max_value);
+}
+
+Result DmntCheatService::ContinueMemoryScan(Out<u64> out_count, u32 condition, u64 value, u64 max_value) {
+    return DmntCheatScanner::ContinueScan(out_count.GetPointer(), static_cast<DmntScanCondition>(condition), value, max_value);
+}
+
+Result DmntCheatService::GetMemoryScanResultCount(Out<u64> out_count) {
+    return DmntCheatScanner::GetResultCount(out_count.GetPointer());
+}
+
+Result DmntCheatService::GetMemoryScanResults(OutBuffer<DmntScanResult> results, Out<u64> out_count, u64 offset) {
+    return DmntCheatScanner::GetResults(results.buffer, results.num_elements, out_count.GetPointer(), offset);
+}
+
+void DmntCheatService::ClearMemoryScan() {
+    DmntCheatScanner::ClearScan();
+}
@@ -39,11 +39,19 @@ enum DmntCheatCmd {
     DmntCheat_Cmd_ToggleCheat = 65203,
     DmntCheat_Cmd_AddCheat = 65204,
     DmntCheat_Cmd_RemoveCheat = 65205,
+    DmntCheat_Cmd_SetCheatVmTickRate = 65206,
     
     /* Interact with Frozen Addresses */
     DmntCheat_Cmd_GetFrozenAddressCount = 65300,
     DmntCheat_Cmd_GetFrozenAddresses = 65301,
     DmntCheat_Cmd_ToggleAddressFrozen = 65302,
+    
+    /* Search Memory */
+    DmntCheat_Cmd_StartMemoryScan = 65400,
+    DmntCheat_Cmd_ContinueMemoryScan = 65401,
+    DmntCheat_Cmd_GetMemoryScanResultCount = 65402,
+    DmntCheat_Cmd_GetMemoryScanResults = 65403,
+    DmntCheat_Cmd_ClearMemoryScan = 65404,
 };
 
 class DmntCheatService final : public IServiceObject {
@@ -63,10 +71,17 @@ class DmntCheatService final : public IServiceObject {
         Result ToggleCheat(u32 cheat_id);
         Result AddCheat(InBuffer<CheatDefinition> cheat, Out<u32> out_cheat_id, bool enabled);
         Result RemoveCheat(u32 cheat_id);
+        Result SetCheatVmTickRate(u32 ticks_per_second);
         
         Result GetFrozenAddressCount(Out<u64> out_count);
         Result GetFrozenAddresses(OutBuffer<uintptr_t> addresses, Out<u64> out_count, u64 offset);
         Result ToggleAddressFrozen(uintptr_t address);
+        
+        Result StartMemoryScan(Out<u64> out_count, u32 value_type, u32 condition, u64 value, u64 max_value);
+        Result ContinueMemoryScan(Out<u64> out_count, u32 condition, u64 value, u64 max_value);
+        Result GetMemoryScanResultCount(Out<u64> out_count);
+        Result GetMemoryScanResults(OutBuffer<DmntScanResult> results, Out<u64> out_count, u64 offset);
+        void ClearMemoryScan();
 
     public:
         DEFINE_SERVICE_DISPATCH_TABLE {
@@ -85,9 +100,16 @@ class DmntCheatService final : public IServiceObject {
             MakeServiceCommandMeta<DmntCheat_Cmd_ToggleCheat, &DmntCheatService::ToggleCheat>(),
             MakeServiceCommandMeta<DmntCheat_Cmd_AddCheat, &DmntCheatService::AddCheat>(),
             MakeServiceCommandMeta<DmntCheat_Cmd_RemoveCheat, &DmntCheatService::RemoveCheat>(),
+            MakeServiceCommandMeta<DmntCheat_Cmd_SetCheatVmTickRate, &DmntCheatService::SetCheatVmTickRate>(),
 
             MakeServiceCommandMeta<DmntCheat_Cmd_GetFrozenAddressCount, &DmntCheatService::GetFrozenAddressCount>(),
             MakeServiceCommandMeta<DmntCheat_Cmd_GetFrozenAddresses, &DmntCheatService::GetFrozenAddresses>(),
             MakeServiceCommandMeta<DmntCheat_Cmd_ToggleAddressFrozen, &DmntCheatService::ToggleAddressFrozen>(),
+
+            MakeServiceCommandMeta<DmntCheat_Cmd_StartMemoryScan, &DmntCheatService::StartMemoryScan>(),
+            MakeServiceCommandMeta<DmntCheat_Cmd_ContinueMemoryScan, &DmntCheatService::ContinueMemoryScan>(),
+            MakeServiceCommandMeta<DmntCheat_Cmd_GetMemoryScanResultCount, &DmntCheatService::GetMemoryScanResultCount>(),
+            MakeServiceCommandMeta<DmntCheat_Cmd_GetMemoryScanResults, &DmntCheatService::GetMemoryScanResults>(),
+            MakeServiceCommandMeta<DmntCheat_Cmd_ClearMemoryScan, &DmntCheatService::ClearMemoryScan>(),
         };
 };
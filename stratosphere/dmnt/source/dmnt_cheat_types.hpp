@@ -18,6 +18,24 @@
 #include <switch.h>
 #include <stratosphere.hpp>
 
+enum DmntCheatResult : Result {
+    DmntCheatResult_CheatNotAttached = 0x32C80D,
+    DmntCheatResult_InvalidCheat = 0x32CA0D,
+    DmntCheatResult_UnknownCheatId = 0x32CC0D,
+    DmntCheatResult_OutOfCheats = 0x32CE0D,
+    DmntCheatResult_CheatProgramTooLarge = 0x32D00D,
+    DmntCheatResult_InvalidVmTickRate = 0x32D20D,
+    DmntCheatResult_CheatCannotBeDisabled = 0x32D40D,
+    DmntCheatResult_InvalidBuffer = 0x32D60D,
+    
+    DmntCheatResult_ScanNotActive = 0x33900D,
+    DmntCheatResult_ScanOutOfMemory = 0x33920D,
+    DmntCheatResult_ScanFileError = 0x33940D,
+    DmntCheatResult_ScanTooLarge = 0x33960D,
+    DmntCheatResult_ScanFileCorrupted = 0x33980D,
+    DmntCheatResult_InvalidScan = 0x339A0D,
+};
+
 struct MemoryRegionExtents {
     u64 base;
     u64 size;
@@ -42,4 +60,32 @@ struct CheatEntry {
     bool enabled;
     uint32_t cheat_id;
     CheatDefinition definition;
-};
\ No newline at end of file
+};
+
+enum DmntScanValueType : u32 {
+    DmntScanValueType_U8 = 0,
+    DmntScanValueType_U16 = 1,
+    DmntScanValueType_U32 = 2,
+    DmntScanValueType_U64 = 3,
+    DmntScanValueType_Float = 4,
+    DmntScanValueType_Double = 5,
+};
+
+enum DmntScanCondition : u32 {
+    /* Compare against the given value, or the range from it to the maximum value. */
+    DmntScanCondition_Equal = 0,
+    DmntScanCondition_Range = 1,
+    /* Match everything, remembering it for the next scan. Only valid for a first scan. */
+    DmntScanCondition_Unknown = 2,
+    /* Compare against what the previous scan saw. Only valid after a first scan. */
+    DmntScanCondition_Changed = 3,
+    DmntScanCondition_Unchanged = 4,
+    DmntScanCondition_Increased = 5,
+    DmntScanCondition_Decreased = 6,
+};
+
+struct DmntScanResult {
+    u64 address;
+    /* The value seen by the last scan, zero extended. Floats are given by their bits. */
+    u64 value;
+};
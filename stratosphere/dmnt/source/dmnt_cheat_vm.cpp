@@ -15,6 +15,7 @@
  */
  
 #include <switch.h>
+#include <cstring>
 #include "dmnt_cheat_types.hpp"
 #include "dmnt_cheat_vm.hpp"
 #include "dmnt_cheat_manager.hpp"
@@ -190,18 +191,60 @@ bool DmntCheatVm::DecodeNextOpcode(CheatVmOpcode *out) {
     return valid;
 }
 
-void DmntCheatVm::SkipConditionalBlock() {
-    CheatVmOpcode skip_opcode;
-    while (this->DecodeNextOpcode(&skip_opcode)) {
-        /* Decode instructions until we see end of conditional block. */
-        /* NOTE: This is broken in gateway's implementation. */
-        /* Gateway currently checks for "0x2" instead of "0x20000000" */
-        /* In addition, they do a linear scan instead of correctly decoding opcodes. */
-        /* This causes issues if "0x2" appears as an immediate in the conditional block... */
-        if (skip_opcode.opcode == CheatVmOpcodeType_EndConditionalBlock) {
-            break;
+void DmntCheatVm::CompileProgram() {
+    CheatVmOpcode opcode;
+    
+    /* Decode the whole program up front, stopping at the first invalid opcode as execution would. */
+    this->num_instructions = 0;
+    this->instruction_ptr = 0;
+    this->decode_success = true;
+    while (this->DecodeNextOpcode(&opcode)) {
+        this->instructions[this->num_instructions].opcode = opcode;
+        this->instructions[this->num_instructions].skip_target = 0;
+        this->num_instructions++;
+    }
+    
+    /* Resolve where execution resumes when a conditional block is skipped. */
+    /* NOTE: This is the instruction after the next end of conditional block, ignoring nesting, */
+    /* as skipping has always worked. If there isn't one, skipping ends the program. */
+    size_t next_end = this->num_instructions;
+    for (size_t i = this->num_instructions; i > 0; i--) {
+        CheatVmInstruction *instruction = &this->instructions[i - 1];
+        switch (instruction->opcode.opcode) {
+            case CheatVmOpcodeType_EndConditionalBlock:
+                next_end = i;
+                break;
+            case CheatVmOpcodeType_BeginConditionalBlock:
+            case CheatVmOpcodeType_BeginKeypressConditionalBlock:
+                instruction->skip_target = next_end;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+bool DmntCheatVm::LoadProgram(const CheatEntry *cheats, size_t num_cheats) {
+    /* Concatenate the opcodes of all enabled cheats. */
+    this->num_opcodes = 0;
+    for (size_t i = 0; i < num_cheats; i++) {
+        if (!cheats[i].enabled) {
+            continue;
+        }
+        
+        const size_t num_cheat_opcodes = cheats[i].definition.num_opcodes;
+        if (num_cheat_opcodes > sizeof(cheats[i].definition.opcodes) / sizeof(cheats[i].definition.opcodes[0]) || this->num_opcodes + num_cheat_opcodes > MaximumProgramOpcodeCount) {
+            this->num_opcodes = 0;
+            this->num_instructions = 0;
+            return false;
         }
+        
+        std::memcpy(this->program + this->num_opcodes, cheats[i].definition.opcodes, num_cheat_opcodes * sizeof(u32));
+        this->num_opcodes += num_cheat_opcodes;
     }
+    
+    this->CompileProgram();
+    return true;
 }
 
 u64 DmntCheatVm::GetVmInt(VmInt value, u32 bit_width) {
@@ -240,7 +283,6 @@ void DmntCheatVm::ResetState() {
 }
 
 void DmntCheatVm::Execute(const CheatProcessMetadata *metadata) {
-    CheatVmOpcode cur_opcode;
     u64 kDown = 0;
     
     /* TODO: Get Keys down. */
@@ -249,7 +291,9 @@ void DmntCheatVm::Execute(const CheatProcessMetadata *metadata) {
     this->ResetState();
     
     /* Loop until program finishes. */
-    while (this->DecodeNextOpcode(&cur_opcode)) {
+    while (this->instruction_ptr < this->num_instructions) {
+        const CheatVmInstruction *cur_instruction = &this->instructions[this->instruction_ptr++];
+        const CheatVmOpcode &cur_opcode = cur_instruction->opcode;
         switch (cur_opcode.opcode) {
             case CheatVmOpcodeType_StoreStatic:
                 {
@@ -304,7 +348,7 @@ void DmntCheatVm::Execute(const CheatProcessMetadata *metadata) {
                     }
                     /* Skip conditional block if condition not met. */
                     if (!cond_met) {
-                        this->SkipConditionalBlock();
+                        this->instruction_ptr = cur_instruction->skip_target;
                     }
                 }
                 break;
@@ -415,7 +459,7 @@ void DmntCheatVm::Execute(const CheatProcessMetadata *metadata) {
                 /* Check for keypress. */
                 if ((cur_opcode.begin_keypress_cond.key_mask & kDown) != cur_opcode.begin_keypress_cond.key_mask) {
                     /* Keys not pressed. Skip conditional block. */
-                    this->SkipConditionalBlock();
+                    this->instruction_ptr = cur_instruction->skip_target;
                 }
                 break;
             case CheatVmOpcodeType_PerformArithmeticRegister:
@@ -155,20 +155,30 @@ struct CheatVmOpcode {
     };
 };
 
+/* A decoded opcode, along with anything resolved about it when the program was loaded. */
+struct CheatVmInstruction {
+    CheatVmOpcode opcode;
+    /* For conditional blocks, the instruction to resume at when the condition isn't met. */
+    u32 skip_target;
+};
+
 class DmntCheatVm {
     public:
         constexpr static size_t MaximumProgramOpcodeCount = 0x400;
         constexpr static size_t NumRegisters = 0x10;
     private:
         size_t num_opcodes = 0;
+        size_t num_instructions = 0;
+        /* Offset into the program while compiling, index into the instructions while executing. */
         size_t instruction_ptr = 0;
         bool decode_success = false;
         u32 program[MaximumProgramOpcodeCount] = {0};
+        CheatVmInstruction instructions[MaximumProgramOpcodeCount] = {};
         u64 registers[NumRegisters] = {0};
         size_t loop_tops[NumRegisters] = {0};
     private:
         bool DecodeNextOpcode(CheatVmOpcode *out);
-        void SkipConditionalBlock();
+        void CompileProgram();
         void ResetState();
         
         static u64 GetVmInt(VmInt value, u32 bit_width);
@@ -180,5 +190,6 @@ class DmntCheatVm {
             return this->num_opcodes;
         }
         
+        bool LoadProgram(const CheatEntry *cheats, size_t num_cheats);
         void Execute(const CheatProcessMetadata *metadata);
 };
@@ -69,6 +69,11 @@ void __appInit(void) {
         fatalSimple(rc);
     }
     
+    rc = pminfoInitialize();
+    if (R_FAILED(rc)) {
+        fatalSimple(rc);
+    }
+    
     rc = ldrDmntInitialize();
     if (R_FAILED(rc)) {
         fatalSimple(rc);
@@ -120,6 +125,7 @@ void __appExit(void) {
     nsdevExit();
     /* if (kernelAbove300()) { roDmntExit(); } */
     ldrDmntExit();
+    pminfoExit();
     pmdmntExit();
     smExit();
 }